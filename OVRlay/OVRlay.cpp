@@ -32,20 +32,22 @@
 #include <filesystem>
 #include <algorithm>
 #include <array>
+#include <atomic>
+#include <chrono>
 #include <exception>
 #include <memory>
 #include <mutex>
 #include <fstream>
 #include <optional>
 #include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
 #include <d3d11_4.h>
 #pragma comment(lib, "d3d11.lib")
-#include <dxgi1_2.h>
+#include <dxgi1_6.h>
 #pragma comment(lib, "dxgi.lib")
-#include <d3dcompiler.h>
-#pragma comment(lib, "d3dcompiler.lib")
 
 #include <OVR_CAPI.h>
 #include <OVR_CAPI_D3D.h>
@@ -55,6 +57,7 @@
 
 #include <winrt/base.h>
 #include <winrt/windows.foundation.h>
+#include <winrt/windows.foundation.metadata.h>
 #include <winrt/windows.graphics.capture.h>
 #include <windows.graphics.capture.interop.h>
 #include <winrt/windows.graphics.directx.direct3d11.h>
@@ -64,27 +67,276 @@
 
 #include "OVRlay.h"
 
+// Compiled with the project (see the FxCompile items).
+#include "TransparencyShader.h"
+#include "TransparencyShaderColorKey.h"
+#include "TransparencyShaderDownscale.h"
+
 using Microsoft::WRL::ComPtr;
+#ifdef OVRLAY_STANDALONE
+using OVRlay::ovrDispatchTable;
+using OVRlay::ovrDispatchTable2;
+#endif
 
 namespace {
 
 #pragma region "Logging"
-    std::ofstream s_logStream;
+    enum class LogLevel : uint32_t { Verbose = 0, Info, Error };
+
+    // The messages are formatted by the caller into a ring buffer, without allocations or I/O. A background thread
+    // adds the timestamps and writes the messages in batches, or right away for errors. Each call site (identified
+    // by its format string) is limited to a few messages per second, before the message is even formatted, and
+    // identical consecutive messages are only written once.
+    class Logger {
+      public:
+        Logger() {
+            for (size_t i = 0; i < QueueSize; i++) {
+                m_entries[i].sequence.store(i, std::memory_order_relaxed);
+            }
+            m_messageQueued.create(wil::EventOptions::None);
+            m_flushRequested.create(wil::EventOptions::None);
+            m_stopRequested.create(wil::EventOptions::ManualReset);
+            m_writerStopped.create(wil::EventOptions::ManualReset);
+        }
+
+        ~Logger() {
+            close();
+        }
+
+        void open(const std::filesystem::path& path) {
+            m_stream.open(path, std::ios_base::ate);
+            m_isOpen = m_stream.is_open();
+            m_writer = std::thread([this]() { writerThread(); });
+        }
+
+        // Write the pending messages and stop the writer thread. The thread itself is not joined, since this may
+        // happen while the DLL is being unloaded, under the loader lock.
+        void close() {
+            if (!m_writer.joinable()) {
+                return;
+            }
+            m_stopRequested.SetEvent();
+
+            // At process exit, the thread was already terminated.
+            const HANDLE events[] = {m_writerStopped.get(), m_writer.native_handle()};
+            WaitForMultipleObjects(ARRAYSIZE(events), events, false, INFINITE);
+            m_writer.detach();
+            m_isOpen = false;
+        }
+
+        bool isOpen() const {
+            return m_isOpen;
+        }
+
+        void setLevel(LogLevel level) {
+            m_level = level;
+        }
+
+        void write(LogLevel level, const char* fmt, va_list va) {
+            if (level < m_level) {
+                return;
+            }
+
+            uint32_t suppressedCount = 0;
+            if (isRateLimited(fmt, suppressedCount)) {
+                return;
+            }
+            if (suppressedCount) {
+                enqueue([&](char* message, size_t size) {
+                    sprintf_s(message, size, "%u similar messages were suppressed.\n", suppressedCount);
+                });
+            }
+            enqueue([&](char* message, size_t size) { vsnprintf_s(message, size, _TRUNCATE, fmt, va); });
+
+            m_messageQueued.SetEvent();
+            if (level >= LogLevel::Error) {
+                m_flushRequested.SetEvent();
+            }
+        }
+
+      private:
+        static constexpr size_t QueueSize = 256;
+        static constexpr size_t MessageSize = 512;
+        static constexpr DWORD WriteInterval = 100;
+        static constexpr size_t RateLimitSlots = 64;
+        static constexpr uint64_t RateLimitWindow = 1000;
+        static constexpr uint32_t RateLimitMessages = 10;
+
+        struct Entry {
+            std::atomic<size_t> sequence;
+            std::time_t time;
+            char message[MessageSize];
+        };
+
+        // The messages from one call site within the current window. Call sites sharing a slot take it over from
+        // each other. The counts are only approximate when several threads log from the same call site.
+        struct RateLimit {
+            std::atomic<const char*> fmt{nullptr};
+            std::atomic<uint64_t> windowStart{0};
+            std::atomic<uint32_t> count{0};
+            std::atomic<uint32_t> suppressedCount{0};
+        };
+
+        // Whether the message must be dropped. Otherwise, returns how many messages from the same call site were
+        // dropped during the previous window.
+        bool isRateLimited(const char* fmt, uint32_t& suppressedCount) {
+            RateLimit& limit = m_rateLimits[(reinterpret_cast<uintptr_t>(fmt) >> 4) % RateLimitSlots];
+            const uint64_t now = GetTickCount64();
+            const bool isSameCallSite = limit.fmt.load(std::memory_order_relaxed) == fmt;
+            if (!isSameCallSite || now - limit.windowStart.load(std::memory_order_relaxed) >= RateLimitWindow) {
+                suppressedCount = isSameCallSite ? limit.suppressedCount.exchange(0, std::memory_order_relaxed) : 0;
+                if (!isSameCallSite) {
+                    limit.suppressedCount.store(0, std::memory_order_relaxed);
+                }
+                limit.fmt.store(fmt, std::memory_order_relaxed);
+                limit.windowStart.store(now, std::memory_order_relaxed);
+                limit.count.store(1, std::memory_order_relaxed);
+                return false;
+            }
+
+            if (limit.count.fetch_add(1, std::memory_order_relaxed) < RateLimitMessages) {
+                return false;
+            }
+            limit.suppressedCount.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+
+        // Reserve an entry (bounded multi-producer queue) and format the message into it. When the writer falls
+        // behind, the message is dropped.
+        template <typename Formatter>
+        void enqueue(const Formatter& format) {
+            size_t position = m_enqueuePosition.load(std::memory_order_relaxed);
+            Entry* entry;
+            while (true) {
+                entry = &m_entries[position % QueueSize];
+                const size_t sequence = entry->sequence.load(std::memory_order_acquire);
+                if (sequence == position) {
+                    if (m_enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                        break;
+                    }
+                } else if (sequence < position) {
+                    m_droppedCount.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                } else {
+                    position = m_enqueuePosition.load(std::memory_order_relaxed);
+                }
+            }
+
+            entry->time = std::time(nullptr);
+            format(entry->message, sizeof(entry->message));
+            entry->sequence.store(position + 1, std::memory_order_release);
+        }
+
+        void writerThread() {
+            char line[MessageSize + 64];
+            char lastMessage[MessageSize]{};
+            uint32_t repeatCount = 0;
+            const auto writeLine = [&](std::time_t time, const char* message) {
+                const size_t offset =
+                    std::strftime(line, sizeof(line), "%Y-%m-%d %H:%M:%S %z: ", std::localtime(&time));
+                strncpy_s(line + offset, sizeof(line) - offset, message, _TRUNCATE);
+                OutputDebugStringA(line);
+                m_stream << line;
+            };
+            const auto flushRepeats = [&](std::time_t time) {
+                if (repeatCount) {
+                    char message[64];
+                    sprintf_s(message, "Previous message repeated %u times.\n", repeatCount);
+                    writeLine(time, message);
+                    repeatCount = 0;
+                }
+            };
+
+            const HANDLE wakeEvents[] = {m_messageQueued.get(), m_stopRequested.get()};
+            const HANDLE flushEvents[] = {m_flushRequested.get(), m_stopRequested.get()};
+            while (true) {
+                bool isStopping =
+                    WaitForMultipleObjects(ARRAYSIZE(wakeEvents), wakeEvents, false, INFINITE) != WAIT_OBJECT_0;
+
+                // Let bursts of messages be written together, unless there is an error to write.
+                if (!isStopping) {
+                    isStopping = WaitForMultipleObjects(ARRAYSIZE(flushEvents), flushEvents, false, WriteInterval) ==
+                                 WAIT_OBJECT_0 + 1;
+                }
+
+                bool hasWritten = false;
+                while (true) {
+                    Entry& entry = m_entries[m_dequeuePosition % QueueSize];
+                    if (entry.sequence.load(std::memory_order_acquire) != m_dequeuePosition + 1) {
+                        break;
+                    }
+
+                    if (!strcmp(entry.message, lastMessage)) {
+                        repeatCount++;
+                    } else {
+                        flushRepeats(entry.time);
+                        writeLine(entry.time, entry.message);
+                        strcpy_s(lastMessage, entry.message);
+                    }
+                    entry.sequence.store(m_dequeuePosition + QueueSize, std::memory_order_release);
+                    m_dequeuePosition++;
+                    hasWritten = true;
+                }
+
+                const uint32_t droppedCount = m_droppedCount.exchange(0, std::memory_order_relaxed);
+                if (droppedCount) {
+                    flushRepeats(std::time(nullptr));
+                    char message[64];
+                    sprintf_s(message, "%u messages were dropped.\n", droppedCount);
+                    writeLine(std::time(nullptr), message);
+                    lastMessage[0] = 0;
+                }
+                if (isStopping) {
+                    flushRepeats(std::time(nullptr));
+                }
+                if (hasWritten || droppedCount || isStopping) {
+                    m_stream.flush();
+                }
+
+                // Nothing may touch the logger past this point.
+                if (isStopping) {
+                    m_writerStopped.SetEvent();
+                    return;
+                }
+            }
+        }
+
+        std::array<Entry, QueueSize> m_entries;
+        std::atomic<size_t> m_enqueuePosition{0};
+        size_t m_dequeuePosition{0};
+        std::atomic<uint32_t> m_droppedCount{0};
+        std::atomic<LogLevel> m_level{LogLevel::Info};
+        std::array<RateLimit, RateLimitSlots> m_rateLimits;
+        wil::unique_event m_messageQueued;
+        wil::unique_event m_flushRequested;
+        wil::unique_event m_stopRequested;
+        wil::unique_event m_writerStopped;
+        std::thread m_writer;
+        std::atomic<bool> m_isOpen{false};
+        std::ofstream m_stream;
+    };
+
+    Logger s_logger;
 
     void Log(const char* fmt, ...) {
-        const std::time_t now = std::time(nullptr);
+        va_list va;
+        va_start(va, fmt);
+        s_logger.write(LogLevel::Info, fmt, va);
+        va_end(va);
+    }
 
-        char buf[1024];
-        size_t offset = std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S %z: ", std::localtime(&now));
+    void LogVerbose(const char* fmt, ...) {
         va_list va;
         va_start(va, fmt);
-        vsnprintf_s(buf + offset, sizeof(buf) - offset, _TRUNCATE, fmt, va);
+        s_logger.write(LogLevel::Verbose, fmt, va);
+        va_end(va);
+    }
+
+    void LogError(const char* fmt, ...) {
+        va_list va;
+        va_start(va, fmt);
+        s_logger.write(LogLevel::Error, fmt, va);
         va_end(va);
-        OutputDebugStringA(buf);
-        if (s_logStream.is_open()) {
-            s_logStream << buf;
-            s_logStream.flush();
-        }
     }
 
 #define CHECK_HRCMD(cmd) _CheckHResult(cmd, #cmd, FILE_AND_LINE)
@@ -161,6 +413,32 @@ namespace {
     }
 #pragma endregion
 
+#pragma region Transparency Shader
+
+    // Must match the numthreads() declarations in the TransparencyShader*.hlsl files.
+    static constexpr uint32_t TransparencyShaderGroupSize = 8;
+
+    struct TransparencyShaderConstants {
+        ovrVector3f transparentColor;
+        float alpha;
+        uint32_t width;
+        uint32_t height;
+        float tolerance;
+        uint32_t downscale;
+        float colorScale;
+        // Only the region from offset to (width, height) is written, at the destination offset.
+        uint32_t offsetX;
+        uint32_t offsetY;
+        float padding0;
+        uint32_t destOffsetX;
+        uint32_t destOffsetY;
+        // The extent of the source content, for the downscaling shader to average only the pixels within it.
+        uint32_t sourceWidth;
+        uint32_t sourceHeight;
+    };
+
+#pragma endregion
+
 #pragma region "CaptureWindow"
     // Alternative to windows.graphics.directx.direct3d11.interop.h
     extern "C" {
@@ -177,7 +455,27 @@ namespace {
 
     class CaptureWindow {
       public:
-        CaptureWindow(ID3D11Device* device, HWND window) {
+        // The number of buffers in the capture frame pool.
+        static constexpr int32_t FramePoolSize = 2;
+
+        // A dirty region covering any surface.
+        static constexpr RECT EverythingDirty{0, 0, LONG_MAX, LONG_MAX};
+
+        // The device of the adapter driving the captured output, when it is not the adapter of the device consuming
+        // the surfaces. The frames are captured on that adapter, and only their dirty region is moved to the consumer
+        // device through a cross-adapter texture, after downscaling it on that adapter (see setTransferDownscale()).
+        struct OwningAdapter {
+            ID3D11Device5* device;
+            ID3D11DeviceContext4* context;
+            // The downscale shader, created on that device.
+            ID3D11ComputeShader* downscaleShader;
+        };
+
+        CaptureWindow(ID3D11Device* device,
+                      HWND window,
+                      DXGI_FORMAT format,
+                      HANDLE frameArrivedEvent = nullptr,
+                      const OwningAdapter* owningAdapter = nullptr) {
             auto interop_factory = winrt::get_activation_factory<winrt::Windows::Graphics::Capture::GraphicsCaptureItem,
                                                                  IGraphicsCaptureItemInterop>();
             CHECK_HRCMD(interop_factory->CreateForWindow(
@@ -185,10 +483,14 @@ namespace {
                 winrt::guid_of<ABI::Windows::Graphics::Capture::IGraphicsCaptureItem>(),
                 winrt::put_abi(m_item)));
 
-            initialize(device);
+            initialize(device, format, frameArrivedEvent, owningAdapter);
         }
 
-        CaptureWindow(ID3D11Device* device, HMONITOR monitor) {
+        CaptureWindow(ID3D11Device* device,
+                      HMONITOR monitor,
+                      DXGI_FORMAT format,
+                      HANDLE frameArrivedEvent = nullptr,
+                      const OwningAdapter* owningAdapter = nullptr) {
             auto interop_factory = winrt::get_activation_factory<winrt::Windows::Graphics::Capture::GraphicsCaptureItem,
                                                                  IGraphicsCaptureItemInterop>();
             CHECK_HRCMD(interop_factory->CreateForMonitor(
@@ -196,144 +498,1009 @@ namespace {
                 winrt::guid_of<ABI::Windows::Graphics::Capture::IGraphicsCaptureItem>(),
                 winrt::put_abi(m_item)));
 
-            initialize(device);
+            initialize(device, format, frameArrivedEvent, owningAdapter);
         }
 
         ~CaptureWindow() {
+            m_frameArrived.revoke();
             m_session.Close();
             m_framePool.Close();
         }
 
         ID3D11Texture2D* getSurface() const {
-            auto frame = m_framePool.TryGetNextFrame();
+            // Skip to the most recent frame, since windows are not always updated at every frame.
+            winrt::Windows::Graphics::Capture::Direct3D11CaptureFrame frame{nullptr};
+            while (auto nextFrame = m_framePool.TryGetNextFrame()) {
+                frame = nextFrame;
+                accumulateDirtyRegions(frame);
+            }
+
+            ComPtr<ID3D11Texture2D> surface;
             if (frame != nullptr) {
-                ComPtr<ID3D11Texture2D> surface;
                 auto access = frame.Surface().as<IDirect3DDXGIInterfaceAccess>();
                 CHECK_HRCMD(access->GetInterface(winrt::guid_of<ID3D11Texture2D>(),
                                                  reinterpret_cast<void**>(surface.ReleaseAndGetAddressOf())));
+            } else if (m_owningContext && m_lastOwningSurface && getTransferDownscale() != m_surfaceDownscale) {
+                // Transfer the last frame again, at the new resolution.
+                surface = m_lastOwningSurface;
+            }
 
-                m_lastCapturedFrame = frame;
+            if (surface && m_owningContext) {
+                const ComPtr<ID3D11Texture2D> owningSurface = surface;
+                try {
+                    surface = transferSurface(owningSurface.Get());
+                    m_lastOwningSurface = owningSurface;
+                } catch (std::exception& exc) {
+                    // Drop this frame, the next ones are captured on the consumer device.
+                    LogError("Cross-adapter transfer error: %s\n", exc.what());
+                    fallBackToLocalCapture();
+                    surface = nullptr;
+                }
+            }
+            if (surface) {
                 m_lastCapturedSurface = surface;
+                m_frameGeneration++;
+            }
+
+            if (frame != nullptr) {
+                if (surface) {
+                    m_lastCapturedFrame = frame;
+                    m_lastContentSize = {frame.ContentSize().Width, frame.ContentSize().Height};
+                }
+
+                // Follow the size of the window, so that the next frames are neither cropped nor padded. The frame we
+                // just received remains valid.
+                const auto contentSize = frame.ContentSize();
+                if (contentSize.Width > 0 && contentSize.Height > 0 &&
+                    (contentSize.Width != m_framePoolSize.Width || contentSize.Height != m_framePoolSize.Height)) {
+                    m_framePoolSize = contentSize;
+                    m_framePool.Recreate(m_interopDevice, m_pixelFormat, FramePoolSize, m_framePoolSize);
+                    m_dirtyRect = m_transferRect = EverythingDirty;
+                }
             }
 
             return m_lastCapturedSurface.Get();
         }
 
+        // The surface of the last frame received by getSurface(), without polling for a new frame.
+        ID3D11Texture2D* getLastSurface() const {
+            return m_lastCapturedSurface.Get();
+        }
+
+        // A counter incremented every time getSurface() receives a new frame.
+        uint64_t getFrameGeneration() const {
+            return m_frameGeneration;
+        }
+
+        // The bounding box of what changed in the frames received by getSurface() since the last call, in surface
+        // coordinates. Everything is reported as dirty when the OS does not report dirty regions.
+        RECT takeDirtyRect() {
+            return scaleRect(std::exchange(m_dirtyRect, RECT{}), m_surfaceDownscale);
+        }
+
         ovrSizei getSize() const {
             return {m_item.Size().Width, m_item.Size().Height};
         }
 
+        // Whether the frames are captured on another adapter than the one of the consumer device.
+        bool isCrossAdapter() const {
+            return m_owningContext != nullptr;
+        }
+
+        // Downscale the frames captured on another adapter before moving them to the consumer device. This applies
+        // from the next call to getSurface().
+        void setTransferDownscale(uint32_t downscale) {
+            m_transferDownscale = downscale;
+        }
+
+        // How much the surfaces returned by getSurface() are already downscaled, compared to the content size.
+        uint32_t getSurfaceDownscale() const {
+            return m_surfaceDownscale;
+        }
+
+        // The size of the content of the last frame received by getSurface().
+        ovrSizei getContentSize() const {
+            return m_lastContentSize;
+        }
+
+        // Let the OS capture less often, for windows that are not updated at every frame (when supported).
+        void setMinUpdateInterval(std::chrono::microseconds interval) {
+            static const bool isSupported = winrt::Windows::Foundation::Metadata::ApiInformation::IsPropertyPresent(
+                L"Windows.Graphics.Capture.GraphicsCaptureSession", L"MinUpdateInterval");
+            if (isSupported) {
+                m_session.MinUpdateInterval(interval);
+            }
+        }
+
       private:
-        void initialize(ID3D11Device* device) {
+        void initialize(ID3D11Device* device,
+                        DXGI_FORMAT format,
+                        HANDLE frameArrivedEvent,
+                        const OwningAdapter* owningAdapter) {
+            if (owningAdapter) {
+                CHECK_HRCMD(device->QueryInterface(IID_PPV_ARGS(m_consumerDevice.ReleaseAndGetAddressOf())));
+                ComPtr<ID3D11DeviceContext> context;
+                m_consumerDevice->GetImmediateContext(context.GetAddressOf());
+                CHECK_HRCMD(context->QueryInterface(IID_PPV_ARGS(m_consumerContext.ReleaseAndGetAddressOf())));
+                m_owningDevice = owningAdapter->device;
+                m_owningContext = owningAdapter->context;
+
+                // The consumer waits for the copy on the owning adapter to complete before reading the transfer
+                // texture, and the owning adapter waits for the consumer to be done reading it before the next copy.
+                wil::unique_handle fenceHandle;
+                CHECK_HRCMD(m_owningDevice->CreateFence(
+                    0,
+                    D3D11_FENCE_FLAG_SHARED | D3D11_FENCE_FLAG_SHARED_CROSS_ADAPTER,
+                    IID_PPV_ARGS(m_owningFence.ReleaseAndGetAddressOf())));
+                CHECK_HRCMD(m_owningFence->CreateSharedHandle(nullptr, GENERIC_ALL, nullptr, fenceHandle.put()));
+                CHECK_HRCMD(m_consumerDevice->OpenSharedFence(fenceHandle.get(),
+                                                              IID_PPV_ARGS(m_consumerFence.ReleaseAndGetAddressOf())));
+                wil::unique_handle releaseFenceHandle;
+                CHECK_HRCMD(m_consumerDevice->CreateFence(
+                    0,
+                    D3D11_FENCE_FLAG_SHARED | D3D11_FENCE_FLAG_SHARED_CROSS_ADAPTER,
+                    IID_PPV_ARGS(m_consumerReleaseFence.ReleaseAndGetAddressOf())));
+                CHECK_HRCMD(m_consumerReleaseFence->CreateSharedHandle(
+                    nullptr, GENERIC_ALL, nullptr, releaseFenceHandle.put()));
+                CHECK_HRCMD(m_owningDevice->OpenSharedFence(
+                    releaseFenceHandle.get(), IID_PPV_ARGS(m_owningReleaseFence.ReleaseAndGetAddressOf())));
+
+                // Downscaling needs to write the capture format on the owning adapter.
+                D3D11_FEATURE_DATA_FORMAT_SUPPORT2 support{format};
+                if (owningAdapter->downscaleShader &&
+                    SUCCEEDED(m_owningDevice->CheckFeatureSupport(
+                        D3D11_FEATURE_FORMAT_SUPPORT2, &support, sizeof(support))) &&
+                    (support.OutFormatSupport2 & D3D11_FORMAT_SUPPORT2_UAV_TYPED_STORE)) {
+                    D3D11_BUFFER_DESC desc{};
+                    desc.ByteWidth = sizeof(TransparencyShaderConstants);
+                    desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+                    desc.Usage = D3D11_USAGE_DYNAMIC;
+                    desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+                    CHECK_HRCMD(
+                        m_owningDevice->CreateBuffer(&desc, nullptr, m_owningConstants.ReleaseAndGetAddressOf()));
+                    m_owningDownscaleShader = owningAdapter->downscaleShader;
+                }
+                device = m_owningDevice.Get();
+            }
+
+            m_interopDevice = createInteropDevice(device);
+            m_pixelFormat = static_cast<winrt::Windows::Graphics::DirectX::DirectXPixelFormat>(format);
+            m_framePoolSize = m_item.Size();
+
+            // Create the transfer resources upfront, so that a failure falls back to capturing on the consumer device.
+            if (m_owningContext) {
+                D3D11_TEXTURE2D_DESC desc{};
+                desc.Width = m_framePoolSize.Width;
+                desc.Height = m_framePoolSize.Height;
+                desc.Format = format;
+                createTransferResources(desc, false);
+            }
+
+            m_framePool = winrt::Windows::Graphics::Capture::Direct3D11CaptureFramePool::CreateFreeThreaded(
+                m_interopDevice, m_pixelFormat, FramePoolSize, m_framePoolSize);
+            if (frameArrivedEvent) {
+                // The free-threaded frame pool invokes the handler from a worker thread.
+                m_frameArrived = m_framePool.FrameArrived(
+                    winrt::auto_revoke, [frameArrivedEvent](const auto&, const auto&) { SetEvent(frameArrivedEvent); });
+            }
+            m_session = m_framePool.CreateCaptureSession(m_item);
+
+            // Only ask for the dirty regions to be reported: the frames must still be complete, since they are copied
+            // into swapchain images holding older content.
+            static const bool isDirtyRegionModeSupported =
+                winrt::Windows::Foundation::Metadata::ApiInformation::IsPropertyPresent(
+                    L"Windows.Graphics.Capture.GraphicsCaptureSession", L"DirtyRegionMode");
+            if (isDirtyRegionModeSupported) {
+                try {
+                    m_session.DirtyRegionMode(
+                        winrt::Windows::Graphics::Capture::GraphicsCaptureDirtyRegionMode::ReportOnly);
+                    m_isDirtyRegionReported = true;
+                } catch (winrt::hresult_error&) {
+                }
+            }
+
+            m_session.StartCapture();
+        }
+
+        static winrt::Windows::Graphics::DirectX::Direct3D11::IDirect3DDevice
+        createInteropDevice(ID3D11Device* device) {
             ComPtr<IDXGIDevice> dxgiDevice;
             CHECK_HRCMD(device->QueryInterface(IID_PPV_ARGS(dxgiDevice.ReleaseAndGetAddressOf())));
             ComPtr<IInspectable> object;
             CHECK_HRCMD(CreateDirect3D11DeviceFromDXGIDevice(dxgiDevice.Get(), object.GetAddressOf()));
+            winrt::Windows::Graphics::DirectX::Direct3D11::IDirect3DDevice interopDevice;
             CHECK_HRCMD(
                 object->QueryInterface(winrt::guid_of<winrt::Windows::Graphics::DirectX::Direct3D11::IDirect3DDevice>(),
-                                       winrt::put_abi(m_interopDevice)));
+                                       winrt::put_abi(interopDevice)));
+            return interopDevice;
+        }
 
-            m_framePool = winrt::Windows::Graphics::Capture::Direct3D11CaptureFramePool::CreateFreeThreaded(
-                m_interopDevice,
-                static_cast<winrt::Windows::Graphics::DirectX::DirectXPixelFormat>(DXGI_FORMAT_R8G8B8A8_UNORM),
-                2,
-                m_item.Size());
-            m_session = m_framePool.CreateCaptureSession(m_item);
-            m_session.StartCapture();
+        // Stop capturing on the owning adapter, and capture the next frames on the consumer device.
+        void fallBackToLocalCapture() const {
+            m_owningContext = nullptr;
+            m_owningTransfer = nullptr;
+            m_owningDownscaled = nullptr;
+            m_owningDownscaledView = nullptr;
+            m_owningSurfaceViews.clear();
+            m_lastOwningSurface = nullptr;
+            m_consumerTransfer = nullptr;
+            m_consumerSurface = nullptr;
+            m_surfaceDownscale = 1;
+            m_interopDevice = createInteropDevice(m_consumerDevice.Get());
+            m_framePool.Recreate(m_interopDevice, m_pixelFormat, FramePoolSize, m_framePoolSize);
+            m_dirtyRect = EverythingDirty;
+        }
+
+        // The downscale to apply before the transfer, if it can be done on the owning adapter.
+        uint32_t getTransferDownscale() const {
+            return m_owningDownscaleShader ? m_transferDownscale.load() : 1;
+        }
+
+        // The rectangle covering the same pixels once downscaled.
+        static RECT scaleRect(const RECT& rect, uint32_t downscale) {
+            return {rect.left / (LONG)downscale,
+                    rect.top / (LONG)downscale,
+                    rect.right / (LONG)downscale + (rect.right % (LONG)downscale ? 1 : 0),
+                    rect.bottom / (LONG)downscale + (rect.bottom % (LONG)downscale ? 1 : 0)};
+        }
+
+        void accumulateDirtyRegions(const winrt::Windows::Graphics::Capture::Direct3D11CaptureFrame& frame) const {
+            using winrt::Windows::Graphics::Capture::GraphicsCaptureDirtyRegionMode;
+            if (!m_isDirtyRegionReported || frame.DirtyRegionMode() != GraphicsCaptureDirtyRegionMode::ReportOnly) {
+                m_dirtyRect = m_transferRect = EverythingDirty;
+                return;
+            }
+
+            for (const auto& region : frame.DirtyRegions()) {
+                const RECT rect{region.X, region.Y, region.X + region.Width, region.Y + region.Height};
+                UnionRect(&m_dirtyRect, &m_dirtyRect, &rect);
+                UnionRect(&m_transferRect, &m_transferRect, &rect);
+            }
+        }
+
+        // The transfer textures hold the (downscaled) content, as described.
+        void createTransferResources(const D3D11_TEXTURE2D_DESC& desc, bool isDownscaled) const {
+            ComPtr<ID3D11Device3> owningDevice3;
+            CHECK_HRCMD(m_owningDevice.As(&owningDevice3));
+            D3D11_TEXTURE2D_DESC1 transferDesc{};
+            transferDesc.Width = desc.Width;
+            transferDesc.Height = desc.Height;
+            transferDesc.MipLevels = 1;
+            transferDesc.ArraySize = 1;
+            transferDesc.Format = desc.Format;
+            transferDesc.SampleDesc.Count = 1;
+            transferDesc.Usage = D3D11_USAGE_DEFAULT;
+            transferDesc.MiscFlags = D3D11_RESOURCE_MISC_SHARED | D3D11_RESOURCE_MISC_SHARED_NTHANDLE;
+            transferDesc.TextureLayout = D3D11_TEXTURE_LAYOUT_ROW_MAJOR;
+            CHECK_HRCMD(owningDevice3->CreateTexture2D1(
+                &transferDesc, nullptr, m_owningTransfer.ReleaseAndGetAddressOf()));
+
+            ComPtr<IDXGIResource1> dxgiResource;
+            CHECK_HRCMD(m_owningTransfer.As(&dxgiResource));
+            wil::unique_handle textureHandle;
+            CHECK_HRCMD(dxgiResource->CreateSharedHandle(
+                nullptr, DXGI_SHARED_RESOURCE_READ | DXGI_SHARED_RESOURCE_WRITE, nullptr, textureHandle.put()));
+            CHECK_HRCMD(m_consumerDevice->OpenSharedResource1(
+                textureHandle.get(), IID_PPV_ARGS(m_consumerTransfer.ReleaseAndGetAddressOf())));
+
+            D3D11_TEXTURE2D_DESC surfaceDesc{};
+            surfaceDesc.Width = desc.Width;
+            surfaceDesc.Height = desc.Height;
+            surfaceDesc.MipLevels = 1;
+            surfaceDesc.ArraySize = 1;
+            surfaceDesc.Format = desc.Format;
+            surfaceDesc.SampleDesc.Count = 1;
+            surfaceDesc.Usage = D3D11_USAGE_DEFAULT;
+            surfaceDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+            CHECK_HRCMD(m_consumerDevice->CreateTexture2D(
+                &surfaceDesc, nullptr, m_consumerSurface.ReleaseAndGetAddressOf()));
+
+            // The downscale shader cannot write the row-major texture.
+            if (isDownscaled) {
+                D3D11_TEXTURE2D_DESC downscaledDesc = surfaceDesc;
+                downscaledDesc.BindFlags = D3D11_BIND_UNORDERED_ACCESS;
+                CHECK_HRCMD(m_owningDevice->CreateTexture2D(
+                    &downscaledDesc, nullptr, m_owningDownscaled.ReleaseAndGetAddressOf()));
+                D3D11_UNORDERED_ACCESS_VIEW_DESC viewDesc{};
+                viewDesc.ViewDimension = D3D11_UAV_DIMENSION_TEXTURE2D;
+                viewDesc.Format = desc.Format;
+                CHECK_HRCMD(m_owningDevice->CreateUnorderedAccessView(
+                    m_owningDownscaled.Get(), &viewDesc, m_owningDownscaledView.ReleaseAndGetAddressOf()));
+            } else {
+                m_owningDownscaled = nullptr;
+                m_owningDownscaledView = nullptr;
+            }
+
+            m_transferDesc = desc;
+            m_transferRect = EverythingDirty;
+        }
+
+        // Get the (cached) shader resource view for a surface captured on the owning adapter.
+        ID3D11ShaderResourceView* getOwningSurfaceView(ID3D11Texture2D* surface, DXGI_FORMAT format) const {
+            for (const auto& entry : m_owningSurfaceViews) {
+                if (entry.first.Get() == surface) {
+                    return entry.second.Get();
+                }
+            }
+
+            // The frame pool may have reallocated its buffers: drop the stale views.
+            if (m_owningSurfaceViews.size() >= FramePoolSize) {
+                m_owningSurfaceViews.clear();
+            }
+
+            ComPtr<ID3D11ShaderResourceView> srv;
+            D3D11_SHADER_RESOURCE_VIEW_DESC desc{};
+            desc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
+            desc.Format = format;
+            desc.Texture2D.MipLevels = 1;
+            CHECK_HRCMD(m_owningDevice->CreateShaderResourceView(surface, &desc, srv.ReleaseAndGetAddressOf()));
+            m_owningSurfaceViews.push_back(std::make_pair(surface, srv));
+
+            return srv.Get();
+        }
+
+        // Box filter what changed into the downscaled texture of the owning adapter.
+        void downscaleOnOwningAdapter(ID3D11Texture2D* surface,
+                                      const D3D11_TEXTURE2D_DESC& desc,
+                                      const D3D11_BOX& box,
+                                      uint32_t downscale) const {
+            TransparencyShaderConstants constants{};
+            constants.transparentColor = {-1, -1, -1};
+            constants.alpha = 1.f;
+            constants.width = box.right;
+            constants.height = box.bottom;
+            constants.offsetX = box.left;
+            constants.offsetY = box.top;
+            constants.downscale = downscale;
+            constants.colorScale = 1.f;
+            constants.sourceWidth = desc.Width;
+            constants.sourceHeight = desc.Height;
+            D3D11_MAPPED_SUBRESOURCE mappedResources;
+            CHECK_HRCMD(
+                m_owningContext->Map(m_owningConstants.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResources));
+            memcpy(mappedResources.pData, &constants, sizeof(constants));
+            m_owningContext->Unmap(m_owningConstants.Get(), 0);
+
+            ID3D11ShaderResourceView* srv = getOwningSurfaceView(surface, desc.Format);
+            ID3D11UnorderedAccessView* uav = m_owningDownscaledView.Get();
+            m_owningContext->CSSetShader(m_owningDownscaleShader.Get(), nullptr, 0);
+            m_owningContext->CSSetShaderResources(0, 1, &srv);
+            m_owningContext->CSSetConstantBuffers(0, 1, m_owningConstants.GetAddressOf());
+            m_owningContext->CSSetUnorderedAccessViews(0, 1, &uav, nullptr);
+            m_owningContext->Dispatch(
+                (box.right - box.left + TransparencyShaderGroupSize - 1) / TransparencyShaderGroupSize,
+                (box.bottom - box.top + TransparencyShaderGroupSize - 1) / TransparencyShaderGroupSize,
+                1);
+
+            // Unbind all resources to avoid D3D validation errors.
+            {
+                m_owningContext->CSSetShader(nullptr, nullptr, 0);
+                ID3D11ShaderResourceView* nullSRV[] = {nullptr};
+                m_owningContext->CSSetShaderResources(0, 1, nullSRV);
+                ID3D11Buffer* nullCBV[] = {nullptr};
+                m_owningContext->CSSetConstantBuffers(0, 1, nullCBV);
+                ID3D11UnorderedAccessView* nullUAV[] = {nullptr};
+                m_owningContext->CSSetUnorderedAccessViews(0, 1, nullUAV, nullptr);
+            }
+        }
+
+        // Move what changed in the frame captured on the owning adapter to a surface of the consumer device. The
+        // cross-adapter texture must be row-major, so it cannot be sampled directly and is copied once more on the
+        // consumer side. When the content is displayed downscaled, it is downscaled before the transfer, so that only
+        // the reduced content crosses over.
+        ComPtr<ID3D11Texture2D> transferSurface(ID3D11Texture2D* surface) const {
+            D3D11_TEXTURE2D_DESC desc{};
+            surface->GetDesc(&desc);
+            const uint32_t downscale = getTransferDownscale();
+            if (downscale != m_surfaceDownscale) {
+                m_surfaceDownscale = downscale;
+                m_dirtyRect = m_transferRect = EverythingDirty;
+            }
+
+            D3D11_TEXTURE2D_DESC transferDesc = desc;
+            transferDesc.Width = (desc.Width + downscale - 1) / downscale;
+            transferDesc.Height = (desc.Height + downscale - 1) / downscale;
+            if (!m_consumerSurface || m_transferDesc.Width != transferDesc.Width ||
+                m_transferDesc.Height != transferDesc.Height || m_transferDesc.Format != transferDesc.Format ||
+                (downscale > 1) != (m_owningDownscaled != nullptr)) {
+                createTransferResources(transferDesc, downscale > 1);
+            }
+
+            const RECT surfaceRect{0, 0, static_cast<LONG>(desc.Width), static_cast<LONG>(desc.Height)};
+            RECT rect;
+            if (IntersectRect(&rect, &m_transferRect, &surfaceRect)) {
+                rect = scaleRect(rect, downscale);
+                const D3D11_BOX box{static_cast<UINT>(rect.left),
+                                    static_cast<UINT>(rect.top),
+                                    0,
+                                    static_cast<UINT>(rect.right),
+                                    static_cast<UINT>(rect.bottom),
+                                    1};
+                ID3D11Texture2D* source = surface;
+                if (downscale > 1) {
+                    downscaleOnOwningAdapter(surface, desc, box, downscale);
+                    source = m_owningDownscaled.Get();
+                }
+
+                // There is a single transfer texture: do not overwrite it while the previous copy out of it is pending.
+                m_owningContext->Wait(m_owningReleaseFence.Get(), m_releaseFenceValue);
+                m_owningContext->CopySubresourceRegion(
+                    m_owningTransfer.Get(), 0, box.left, box.top, 0, source, 0, &box);
+                m_owningContext->Signal(m_owningFence.Get(), ++m_transferFenceValue);
+                m_owningContext->Flush();
+
+                m_consumerContext->Wait(m_consumerFence.Get(), m_transferFenceValue);
+                m_consumerContext->CopySubresourceRegion(
+                    m_consumerSurface.Get(), 0, box.left, box.top, 0, m_consumerTransfer.Get(), 0, &box);
+                m_consumerContext->Signal(m_consumerReleaseFence.Get(), ++m_releaseFenceValue);
+            }
+            m_transferRect = {};
+
+            return m_consumerSurface;
         }
 
-        winrt::Windows::Graphics::DirectX::Direct3D11::IDirect3DDevice m_interopDevice;
+        mutable winrt::Windows::Graphics::DirectX::Direct3D11::IDirect3DDevice m_interopDevice;
         winrt::Windows::Graphics::Capture::GraphicsCaptureItem m_item{nullptr};
         winrt::Windows::Graphics::Capture::Direct3D11CaptureFramePool m_framePool{nullptr};
+        winrt::Windows::Graphics::DirectX::DirectXPixelFormat m_pixelFormat{};
+        mutable winrt::Windows::Graphics::SizeInt32 m_framePoolSize{};
         winrt::Windows::Graphics::Capture::GraphicsCaptureSession m_session{nullptr};
+        winrt::Windows::Graphics::Capture::Direct3D11CaptureFramePool::FrameArrived_revoker m_frameArrived;
         mutable winrt::Windows::Graphics::Capture::Direct3D11CaptureFrame m_lastCapturedFrame{nullptr};
         mutable ComPtr<ID3D11Texture2D> m_lastCapturedSurface;
+        mutable ovrSizei m_lastContentSize{};
+        mutable uint64_t m_frameGeneration{0};
+        bool m_isDirtyRegionReported{false};
+        mutable RECT m_dirtyRect{EverythingDirty};
+
+        // Cross-adapter capture.
+        ComPtr<ID3D11Device5> m_consumerDevice;
+        ComPtr<ID3D11DeviceContext4> m_consumerContext;
+        ComPtr<ID3D11Device5> m_owningDevice;
+        mutable ComPtr<ID3D11DeviceContext4> m_owningContext;
+        ComPtr<ID3D11Fence> m_owningFence;
+        ComPtr<ID3D11Fence> m_consumerFence;
+        mutable uint64_t m_transferFenceValue{0};
+        ComPtr<ID3D11Fence> m_consumerReleaseFence;
+        ComPtr<ID3D11Fence> m_owningReleaseFence;
+        mutable uint64_t m_releaseFenceValue{0};
+        mutable D3D11_TEXTURE2D_DESC m_transferDesc{};
+        mutable ComPtr<ID3D11Texture2D> m_owningTransfer;
+        mutable ComPtr<ID3D11Texture2D> m_consumerTransfer;
+        mutable ComPtr<ID3D11Texture2D> m_consumerSurface;
+        mutable RECT m_transferRect{EverythingDirty};
+        mutable ComPtr<ID3D11Texture2D> m_lastOwningSurface;
+
+        // Downscaling on the owning adapter.
+        ComPtr<ID3D11ComputeShader> m_owningDownscaleShader;
+        ComPtr<ID3D11Buffer> m_owningConstants;
+        std::atomic<uint32_t> m_transferDownscale{1};
+        mutable uint32_t m_surfaceDownscale{1};
+        mutable ComPtr<ID3D11Texture2D> m_owningDownscaled;
+        mutable ComPtr<ID3D11UnorderedAccessView> m_owningDownscaledView;
+        mutable std::vector<std::pair<ComPtr<ID3D11Texture2D>, ComPtr<ID3D11ShaderResourceView>>> m_owningSurfaceViews;
     };
 #pragma endregion
 
-#pragma region "Utilities"
-    ovrTextureFormat dxgiToOvrTextureFormat(DXGI_FORMAT format) {
-        switch (format) {
-        case DXGI_FORMAT_R8G8B8A8_UNORM:
-            return OVR_FORMAT_R8G8B8A8_UNORM;
-        case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB:
-            return OVR_FORMAT_R8G8B8A8_UNORM_SRGB;
-        case DXGI_FORMAT_B8G8R8A8_UNORM:
-            return OVR_FORMAT_B8G8R8A8_UNORM;
-        case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB:
-            return OVR_FORMAT_B8G8R8A8_UNORM_SRGB;
-        case DXGI_FORMAT_B8G8R8X8_UNORM:
-            return OVR_FORMAT_B8G8R8X8_UNORM;
-        case DXGI_FORMAT_B8G8R8X8_UNORM_SRGB:
-            return OVR_FORMAT_B8G8R8X8_UNORM_SRGB;
-        case DXGI_FORMAT_R16G16B16A16_FLOAT:
-            return OVR_FORMAT_R16G16B16A16_FLOAT;
-        case DXGI_FORMAT_D16_UNORM:
-            return OVR_FORMAT_D16_UNORM;
-        case DXGI_FORMAT_D24_UNORM_S8_UINT:
-            return OVR_FORMAT_D24_UNORM_S8_UINT;
-        case DXGI_FORMAT_D32_FLOAT:
-            return OVR_FORMAT_D32_FLOAT;
-        case DXGI_FORMAT_D32_FLOAT_S8X24_UINT:
-            return OVR_FORMAT_D32_FLOAT_S8X24_UINT;
-        default:
-            return OVR_FORMAT_UNKNOWN;
-        }
-    }
-
-    namespace geom {
-        using namespace DirectX;
+#pragma region "WindowGeometryCache"
+    // A cache of the geometry of the captured windows, kept up-to-date by WinEvent notifications from a dedicated
+    // thread, so that the render path does not need to query DWM or win32k every frame.
+    class WindowGeometryCache {
+      public:
+        struct Geometry {
+            // The size of the visible window frame (without the invisible resize borders).
+            LONG width;
+            LONG height;
+            // The position of the origin of the window (or monitor) on the desktop.
+            POINT origin;
+            // The monitor the window mostly covers.
+            HMONITOR monitor;
+        };
 
-        inline DirectX::XMVECTOR XM_CALLCONV LoadOvrVector3(const ovrVector3f& vector) {
-            return DirectX::XMLoadFloat3(reinterpret_cast<const XMFLOAT3*>(&vector));
+        WindowGeometryCache(uint32_t capacity) : m_entries(capacity) {
+            s_instance = this;
+            m_threadReady.create(wil::EventOptions::ManualReset);
+            m_thread = std::thread([this]() { eventThread(); });
+            m_threadReady.wait();
         }
 
-        inline DirectX::XMVECTOR XM_CALLCONV LoadOvrQuaternion(const ovrQuatf& quaternion) {
-            return DirectX::XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&quaternion));
+        ~WindowGeometryCache() {
+            PostThreadMessage(m_threadId, WM_QUIT, 0, 0);
+            m_thread.join();
+            s_instance = nullptr;
         }
 
-        inline DirectX::XMMATRIX XM_CALLCONV LoadOvrPose(const ovrPosef& pose) {
-            const DirectX::XMVECTOR orientation = LoadOvrQuaternion(pose.Orientation);
-            const DirectX::XMVECTOR position = LoadOvrVector3(pose.Position);
-            DirectX::XMMATRIX matrix = DirectX::XMMatrixRotationQuaternion(orientation);
-            matrix.r[3] = DirectX::XMVectorAdd(matrix.r[3], position);
-            return matrix;
-        }
+        void track(uint32_t slot, HWND hwnd, HMONITOR monitor) {
+            const Geometry geometry = query(hwnd, monitor);
 
-        inline void XM_CALLCONV StoreOvrVector3(ovrVector3f* outVec, FXMVECTOR inVec) {
-            DirectX::XMStoreFloat3(reinterpret_cast<XMFLOAT3*>(outVec), inVec);
+            std::unique_lock lock(m_mutex);
+            m_entries[slot] = {hwnd, monitor, geometry, true};
         }
 
-        inline void XM_CALLCONV StoreOvrQuaternion(ovrQuatf* outQuat, FXMVECTOR inQuat) {
-            DirectX::XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(outQuat), inQuat);
+        void untrack(uint32_t slot) {
+            std::unique_lock lock(m_mutex);
+            m_entries[slot].isValid = false;
         }
 
-        inline bool XM_CALLCONV StoreOvrPose(ovrPosef* out, FXMMATRIX matrix) {
-            DirectX::XMVECTOR position;
-            DirectX::XMVECTOR orientation;
-            DirectX::XMVECTOR scale;
-
-            if (!DirectX::XMMatrixDecompose(&scale, &orientation, &position, matrix)) {
-                return false; // Non-SRT matrix encountered
+        // Force a refresh, for example when the captured content changed size.
+        void refresh(uint32_t slot) {
+            HWND hwnd;
+            HMONITOR monitor;
+            {
+                std::unique_lock lock(m_mutex);
+                if (!m_entries[slot].isValid) {
+                    return;
+                }
+                hwnd = m_entries[slot].hwnd;
+                monitor = m_entries[slot].monitor;
             }
 
-            StoreOvrQuaternion(&out->Orientation, orientation);
-            StoreOvrVector3(&out->Position, position);
-            return true;
+            const Geometry geometry = query(hwnd, monitor);
+
+            std::unique_lock lock(m_mutex);
+            if (m_entries[slot].isValid && m_entries[slot].hwnd == hwnd && m_entries[slot].monitor == monitor) {
+                m_entries[slot].geometry = geometry;
+            }
         }
 
-        inline ovrQuatf RotationRollPitchYaw(const ovrVector3f& anglesInRadians) {
-            ovrQuatf q;
-            StoreOvrQuaternion(
-                &q, DirectX::XMQuaternionRotationRollPitchYaw(anglesInRadians.x, anglesInRadians.y, anglesInRadians.z));
-            return q;
+        Geometry get(uint32_t slot) const {
+            std::unique_lock lock(m_mutex);
+            return m_entries[slot].geometry;
         }
 
-        void alignToGravity(ovrPosef& pose) {
-            // Remove roll.
-            float yaw, pitch, roll;
-            OVR::Quatf(pose.Orientation).GetYawPitchRoll(&yaw, &pitch, &roll);
-            pose.Orientation = RotationRollPitchYaw({pitch, yaw, 0});
+      private:
+        struct Entry {
+            HWND hwnd;
+            HMONITOR monitor;
+            Geometry geometry;
+            bool isValid;
+        };
+
+        static Geometry query(HWND hwnd, HMONITOR monitor) {
+            Geometry geometry{};
+            if (hwnd) {
+                RECT rc{};
+                if (SUCCEEDED(DwmGetWindowAttribute(hwnd, DWMWA_EXTENDED_FRAME_BOUNDS, &rc, sizeof(rc)))) {
+                    geometry.width = rc.right - rc.left;
+                    geometry.height = rc.bottom - rc.top;
+                }
+                ClientToScreen(hwnd, &geometry.origin);
+                geometry.monitor = MonitorFromWindow(hwnd, MONITOR_DEFAULTTONEAREST);
+            } else {
+                MONITORINFO info{sizeof(MONITORINFO)};
+                if (GetMonitorInfo(monitor, &info)) {
+                    geometry.width = info.rcMonitor.right - info.rcMonitor.left;
+                    geometry.height = info.rcMonitor.bottom - info.rcMonitor.top;
+                    geometry.origin = {info.rcMonitor.left, info.rcMonitor.top};
+                }
+                geometry.monitor = monitor;
+            }
+            return geometry;
+        }
+
+        void onWindowEvent(DWORD event, HWND hwnd) {
+            for (uint32_t i = 0; i < m_entries.size(); i++) {
+                {
+                    std::unique_lock lock(m_mutex);
+                    if (!m_entries[i].isValid || m_entries[i].hwnd != hwnd) {
+                        continue;
+                    }
+                    if (event == EVENT_OBJECT_DESTROY) {
+                        // Keep the last known geometry.
+                        m_entries[i].isValid = false;
+                        continue;
+                    }
+                }
+                refresh(i);
+            }
+        }
+
+        static void CALLBACK winEventProc(HWINEVENTHOOK hook,
+                                          DWORD event,
+                                          HWND hwnd,
+                                          LONG idObject,
+                                          LONG idChild,
+                                          DWORD idEventThread,
+                                          DWORD eventTime) {
+            // Location changes are also reported for the cursor, carets, etc...
+            if (idObject != OBJID_WINDOW || idChild != CHILDID_SELF || !hwnd || !s_instance) {
+                return;
+            }
+            s_instance->onWindowEvent(event, hwnd);
+        }
+
+        void eventThread() {
+            // Make sure the message queue exists before we can be asked to quit.
+            MSG msg;
+            PeekMessage(&msg, nullptr, WM_USER, WM_USER, PM_NOREMOVE);
+            m_threadId = GetCurrentThreadId();
+            m_threadReady.SetEvent();
+
+            // Out-of-context hooks are delivered through this thread's message loop.
+            const HWINEVENTHOOK locationHook = SetWinEventHook(EVENT_OBJECT_LOCATIONCHANGE,
+                                                               EVENT_OBJECT_LOCATIONCHANGE,
+                                                               nullptr,
+                                                               winEventProc,
+                                                               0,
+                                                               0,
+                                                               WINEVENT_OUTOFCONTEXT | WINEVENT_SKIPOWNPROCESS);
+            const HWINEVENTHOOK destroyHook = SetWinEventHook(EVENT_OBJECT_DESTROY,
+                                                              EVENT_OBJECT_DESTROY,
+                                                              nullptr,
+                                                              winEventProc,
+                                                              0,
+                                                              0,
+                                                              WINEVENT_OUTOFCONTEXT | WINEVENT_SKIPOWNPROCESS);
+
+            while (GetMessage(&msg, nullptr, 0, 0) > 0) {
+                TranslateMessage(&msg);
+                DispatchMessage(&msg);
+            }
+
+            if (locationHook) {
+                UnhookWinEvent(locationHook);
+            }
+            if (destroyHook) {
+                UnhookWinEvent(destroyHook);
+            }
+        }
+
+        static inline WindowGeometryCache* s_instance{nullptr};
+
+        std::thread m_thread;
+        DWORD m_threadId{0};
+        wil::unique_event m_threadReady;
+        mutable std::mutex m_mutex;
+        std::vector<Entry> m_entries;
+    };
+#pragma endregion
+
+#pragma region "InputInjector"
+    // Injects the input on a dedicated thread, since SetCursorPos(), SetForegroundWindow() and SendInput() may block
+    // for several milliseconds. There is a single producer (the render thread), which never waits. The cursor position
+    // and the wheel are coalesced by the producer, so that only the discrete events go through the queue, in order.
+    // Each of them carries the cursor position at the time it was queued.
+    class InputInjector {
+      public:
+        InputInjector() {
+            m_eventQueued.create(wil::EventOptions::None);
+            m_stop.create(wil::EventOptions::ManualReset);
+            m_thread = std::thread([this]() { injectionThread(); });
+        }
+
+        ~InputInjector() {
+            m_stop.SetEvent();
+            m_thread.join();
+        }
+
+        void setCursorPos(const POINT& position) {
+            m_cursorPosition = packPosition(position);
+            m_latestCursorPosition.store(m_cursorPosition, std::memory_order_relaxed);
+            m_eventQueued.SetEvent();
+        }
+
+        void setForegroundWindow(HWND hwnd) {
+            Event event{};
+            event.type = EventType::ForegroundWindow;
+            event.hwnd = hwnd;
+            push(event);
+        }
+
+        void sendMouseInput(DWORD flags, DWORD data = 0) {
+            if (flags == MOUSEEVENTF_WHEEL) {
+                m_pendingWheel.fetch_add((LONG)data, std::memory_order_relaxed);
+                m_eventQueued.SetEvent();
+                return;
+            }
+
+            Event event{};
+            event.type = EventType::Mouse;
+            event.flags = flags;
+            event.data = data;
+            push(event);
+        }
+
+      private:
+        enum class EventType { ForegroundWindow, Mouse };
+
+        struct Event {
+            EventType type;
+            uint64_t cursorPosition;
+            HWND hwnd;
+            DWORD flags;
+            DWORD data;
+        };
+
+        // Much more than the events produced in a second.
+        static constexpr size_t QueueSize = 256;
+
+        // Not a position on the desktop.
+        static constexpr uint64_t NoCursorPosition = ~0ull;
+
+        static uint64_t packPosition(const POINT& position) {
+            return ((uint64_t)(uint32_t)position.x << 32) | (uint32_t)position.y;
+        }
+
+        static POINT unpackPosition(uint64_t position) {
+            return {(LONG)(int32_t)(position >> 32), (LONG)(int32_t)(uint32_t)position};
+        }
+
+        void push(Event& event) {
+            event.cursorPosition = m_cursorPosition;
+            const size_t tail = m_tail.load(std::memory_order_relaxed);
+            if (tail - m_head.load(std::memory_order_acquire) == QueueSize) {
+                // Never lose a button event, or the button would remain pressed. Merge them instead, in the order they
+                // would normally be sent.
+                if (event.type == EventType::Mouse) {
+                    m_pendingMouseFlags.fetch_or(event.flags, std::memory_order_relaxed);
+                } else {
+                    m_pendingForegroundWindow.store(event.hwnd, std::memory_order_relaxed);
+                }
+                m_overflowCount.fetch_add(1, std::memory_order_relaxed);
+                m_eventQueued.SetEvent();
+                return;
+            }
+            m_queue[tail % QueueSize] = event;
+            m_tail.store(tail + 1, std::memory_order_release);
+            m_eventQueued.SetEvent();
+        }
+
+        bool pop(Event& event) {
+            const size_t head = m_head.load(std::memory_order_relaxed);
+            if (head == m_tail.load(std::memory_order_acquire)) {
+                return false;
+            }
+            event = m_queue[head % QueueSize];
+            m_head.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        void injectionThread() {
+            std::vector<INPUT> inputs;
+            uint64_t cursorPosition = NoCursorPosition;
+            const auto flushInputs = [&]() {
+                if (!inputs.empty()) {
+                    SendInput((UINT)inputs.size(), inputs.data(), sizeof(INPUT));
+                    inputs.clear();
+                }
+            };
+            const auto moveCursor = [&](uint64_t position) {
+                if (position != NoCursorPosition && position != cursorPosition) {
+                    flushInputs();
+                    const POINT point = unpackPosition(position);
+                    SetCursorPos(point.x, point.y);
+                    cursorPosition = position;
+                }
+            };
+            const auto addMouseInput = [&](DWORD flags, DWORD data) {
+                INPUT input{};
+                input.type = INPUT_MOUSE;
+                input.mi.dwFlags = flags;
+                input.mi.mouseData = data;
+                inputs.push_back(input);
+            };
+
+            const HANDLE events[] = {m_eventQueued.get(), m_stop.get()};
+            while (WaitForMultipleObjects(ARRAYSIZE(events), events, false, INFINITE) == WAIT_OBJECT_0) {
+                Event event;
+                while (pop(event)) {
+                    moveCursor(event.cursorPosition);
+                    switch (event.type) {
+                    case EventType::ForegroundWindow:
+                        flushInputs();
+                        SetForegroundWindow(event.hwnd);
+                        break;
+
+                    case EventType::Mouse:
+                        addMouseInput(event.flags, event.data);
+                        break;
+                    }
+                }
+
+                // The events that did not fit in the queue.
+                const uint32_t overflowCount = m_overflowCount.exchange(0, std::memory_order_relaxed);
+                if (overflowCount) {
+                    LogError("Input queue is full, merged %u events.\n", overflowCount);
+                    const HWND hwnd = m_pendingForegroundWindow.exchange(nullptr, std::memory_order_relaxed);
+                    if (hwnd) {
+                        flushInputs();
+                        SetForegroundWindow(hwnd);
+                    }
+                }
+                moveCursor(m_latestCursorPosition.load(std::memory_order_relaxed));
+                const DWORD mouseFlags = m_pendingMouseFlags.exchange(0, std::memory_order_relaxed);
+                if (mouseFlags & (MOUSEEVENTF_LEFTDOWN | MOUSEEVENTF_RIGHTDOWN | MOUSEEVENTF_MIDDLEDOWN)) {
+                    addMouseInput(mouseFlags & (MOUSEEVENTF_LEFTDOWN | MOUSEEVENTF_RIGHTDOWN | MOUSEEVENTF_MIDDLEDOWN),
+                                  0);
+                }
+                if (mouseFlags & (MOUSEEVENTF_LEFTUP | MOUSEEVENTF_RIGHTUP | MOUSEEVENTF_MIDDLEUP)) {
+                    addMouseInput(mouseFlags & (MOUSEEVENTF_LEFTUP | MOUSEEVENTF_RIGHTUP | MOUSEEVENTF_MIDDLEUP), 0);
+                }
+                const LONG wheel = m_pendingWheel.exchange(0, std::memory_order_relaxed);
+                if (wheel) {
+                    addMouseInput(MOUSEEVENTF_WHEEL, (DWORD)wheel);
+                }
+                flushInputs();
+            }
+        }
+
+        std::array<Event, QueueSize> m_queue;
+        std::atomic<size_t> m_head{0};
+        std::atomic<size_t> m_tail{0};
+
+        // Only accessed by the producer.
+        uint64_t m_cursorPosition{NoCursorPosition};
+
+        // Coalesced input.
+        std::atomic<uint64_t> m_latestCursorPosition{NoCursorPosition};
+        std::atomic<LONG> m_pendingWheel{0};
+        std::atomic<DWORD> m_pendingMouseFlags{0};
+        std::atomic<HWND> m_pendingForegroundWindow{nullptr};
+        std::atomic<uint32_t> m_overflowCount{0};
+
+        std::thread m_thread;
+        wil::unique_event m_eventQueued;
+        wil::unique_event m_stop;
+    };
+#pragma endregion
+
+#pragma region "Utilities"
+    // Read an optional setting from the registry.
+    DWORD getSetting(const wchar_t* name, DWORD defaultValue) {
+        DWORD value = defaultValue;
+        DWORD size = sizeof(value);
+        if (RegGetValueW(HKEY_CURRENT_USER, L"SOFTWARE\\OVRlay", name, RRF_RT_REG_DWORD, nullptr, &value, &size) !=
+            ERROR_SUCCESS) {
+            return defaultValue;
+        }
+        return value;
+    }
+
+    inline int roundUp(int value, int granularity) {
+        return ((value + granularity - 1) / granularity) * granularity;
+    }
+
+    // The scale bringing the SDR white of an HDR desktop (in scRGB) back to 1.0.
+    float getSdrWhiteScale(HMONITOR monitor) {
+        MONITORINFOEXW monitorInfo{};
+        monitorInfo.cbSize = sizeof(monitorInfo);
+        if (!GetMonitorInfoW(monitor, &monitorInfo)) {
+            return 1.f;
+        }
+
+        UINT32 pathCount = 0, modeCount = 0;
+        if (GetDisplayConfigBufferSizes(QDC_ONLY_ACTIVE_PATHS, &pathCount, &modeCount) != ERROR_SUCCESS) {
+            return 1.f;
+        }
+        std::vector<DISPLAYCONFIG_PATH_INFO> paths(pathCount);
+        std::vector<DISPLAYCONFIG_MODE_INFO> modes(modeCount);
+        if (QueryDisplayConfig(QDC_ONLY_ACTIVE_PATHS, &pathCount, paths.data(), &modeCount, modes.data(), nullptr) !=
+            ERROR_SUCCESS) {
+            return 1.f;
+        }
+
+        for (UINT32 i = 0; i < pathCount; i++) {
+            DISPLAYCONFIG_SOURCE_DEVICE_NAME sourceName{};
+            sourceName.header.type = DISPLAYCONFIG_DEVICE_INFO_GET_SOURCE_NAME;
+            sourceName.header.size = sizeof(sourceName);
+            sourceName.header.adapterId = paths[i].sourceInfo.adapterId;
+            sourceName.header.id = paths[i].sourceInfo.id;
+            if (DisplayConfigGetDeviceInfo(&sourceName.header) != ERROR_SUCCESS ||
+                wcscmp(sourceName.viewGdiDeviceName, monitorInfo.szDevice)) {
+                continue;
+            }
+
+            DISPLAYCONFIG_SDR_WHITE_LEVEL whiteLevel{};
+            whiteLevel.header.type = DISPLAYCONFIG_DEVICE_INFO_GET_SDR_WHITE_LEVEL;
+            whiteLevel.header.size = sizeof(whiteLevel);
+            whiteLevel.header.adapterId = paths[i].targetInfo.adapterId;
+            whiteLevel.header.id = paths[i].targetInfo.id;
+            if (DisplayConfigGetDeviceInfo(&whiteLevel.header) == ERROR_SUCCESS && whiteLevel.SDRWhiteLevel) {
+                // A level of 1000 is 80 nits, or 1.0 in scRGB.
+                return 1000.f / whiteLevel.SDRWhiteLevel;
+            }
+        }
+
+        return 1.f;
+    }
+
+    // The captured content is sRGB-encoded. Typeless swapchains let us write it as-is through UNORM views, while
+    // telling the compositor to linearize it.
+    DXGI_FORMAT getSrgbFormat(DXGI_FORMAT format) {
+        switch (format) {
+        case DXGI_FORMAT_R8G8B8A8_UNORM:
+            return DXGI_FORMAT_R8G8B8A8_UNORM_SRGB;
+        case DXGI_FORMAT_B8G8R8A8_UNORM:
+            return DXGI_FORMAT_B8G8R8A8_UNORM_SRGB;
+        case DXGI_FORMAT_B8G8R8X8_UNORM:
+            return DXGI_FORMAT_B8G8R8X8_UNORM_SRGB;
+        default:
+            return format;
+        }
+    }
+
+    ovrTextureFormat dxgiToOvrTextureFormat(DXGI_FORMAT format) {
+        switch (format) {
+        case DXGI_FORMAT_R8G8B8A8_UNORM:
+            return OVR_FORMAT_R8G8B8A8_UNORM;
+        case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB:
+            return OVR_FORMAT_R8G8B8A8_UNORM_SRGB;
+        case DXGI_FORMAT_B8G8R8A8_UNORM:
+            return OVR_FORMAT_B8G8R8A8_UNORM;
+        case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB:
+            return OVR_FORMAT_B8G8R8A8_UNORM_SRGB;
+        case DXGI_FORMAT_B8G8R8X8_UNORM:
+            return OVR_FORMAT_B8G8R8X8_UNORM;
+        case DXGI_FORMAT_B8G8R8X8_UNORM_SRGB:
+            return OVR_FORMAT_B8G8R8X8_UNORM_SRGB;
+        case DXGI_FORMAT_R16G16B16A16_FLOAT:
+            return OVR_FORMAT_R16G16B16A16_FLOAT;
+        case DXGI_FORMAT_D16_UNORM:
+            return OVR_FORMAT_D16_UNORM;
+        case DXGI_FORMAT_D24_UNORM_S8_UINT:
+            return OVR_FORMAT_D24_UNORM_S8_UINT;
+        case DXGI_FORMAT_D32_FLOAT:
+            return OVR_FORMAT_D32_FLOAT;
+        case DXGI_FORMAT_D32_FLOAT_S8X24_UINT:
+            return OVR_FORMAT_D32_FLOAT_S8X24_UINT;
+        default:
+            return OVR_FORMAT_UNKNOWN;
+        }
+    }
+
+    namespace geom {
+        using namespace DirectX;
+
+        inline DirectX::XMVECTOR XM_CALLCONV LoadOvrVector3(const ovrVector3f& vector) {
+            return DirectX::XMLoadFloat3(reinterpret_cast<const XMFLOAT3*>(&vector));
+        }
+
+        inline DirectX::XMVECTOR XM_CALLCONV LoadOvrQuaternion(const ovrQuatf& quaternion) {
+            return DirectX::XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&quaternion));
+        }
+
+        inline DirectX::XMMATRIX XM_CALLCONV LoadOvrPose(const ovrPosef& pose) {
+            const DirectX::XMVECTOR orientation = LoadOvrQuaternion(pose.Orientation);
+            const DirectX::XMVECTOR position = LoadOvrVector3(pose.Position);
+            DirectX::XMMATRIX matrix = DirectX::XMMatrixRotationQuaternion(orientation);
+            matrix.r[3] = DirectX::XMVectorAdd(matrix.r[3], position);
+            return matrix;
+        }
+
+        inline void XM_CALLCONV StoreOvrVector3(ovrVector3f* outVec, FXMVECTOR inVec) {
+            DirectX::XMStoreFloat3(reinterpret_cast<XMFLOAT3*>(outVec), inVec);
+        }
+
+        inline void XM_CALLCONV StoreOvrQuaternion(ovrQuatf* outQuat, FXMVECTOR inQuat) {
+            DirectX::XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(outQuat), inQuat);
+        }
+
+        inline bool XM_CALLCONV StoreOvrPose(ovrPosef* out, FXMMATRIX matrix) {
+            DirectX::XMVECTOR position;
+            DirectX::XMVECTOR orientation;
+            DirectX::XMVECTOR scale;
+
+            if (!DirectX::XMMatrixDecompose(&scale, &orientation, &position, matrix)) {
+                return false; // Non-SRT matrix encountered
+            }
+
+            StoreOvrQuaternion(&out->Orientation, orientation);
+            StoreOvrVector3(&out->Position, position);
+            return true;
+        }
+
+        inline ovrQuatf RotationRollPitchYaw(const ovrVector3f& anglesInRadians) {
+            ovrQuatf q;
+            StoreOvrQuaternion(
+                &q, DirectX::XMQuaternionRotationRollPitchYaw(anglesInRadians.x, anglesInRadians.y, anglesInRadians.z));
+            return q;
+        }
+
+        void alignToGravity(ovrPosef& pose) {
+            // Remove roll.
+            float yaw, pitch, roll;
+            OVR::Quatf(pose.Orientation).GetYawPitchRoll(&yaw, &pitch, &roll);
+            pose.Orientation = RotationRollPitchYaw({pitch, yaw, 0});
         }
 
         void facingCamera(ovrPosef& pose, const ovrPosef& headPose) {
@@ -385,22 +1552,23 @@ namespace {
             return hit;
         }
 
+        // The corners of a quad, in clockwise order.
+        void getQuadCorners(const ovrPosef& quadCenter, const ovrVector2f& quadSize, XMVECTOR (&corners)[4]) {
+            const float halfWidth = quadSize.x / 2.0f;
+            const float halfHeight = quadSize.y / 2.0f;
+            const auto matrix = LoadOvrPose(quadCenter);
+            corners[0] = XMVector4Transform(XMVectorSet(-halfWidth, -halfHeight, 0, 1), matrix);
+            corners[1] = XMVector4Transform(XMVectorSet(-halfWidth, halfHeight, 0, 1), matrix);
+            corners[2] = XMVector4Transform(XMVectorSet(halfWidth, halfHeight, 0, 1), matrix);
+            corners[3] = XMVector4Transform(XMVectorSet(halfWidth, -halfHeight, 0, 1), matrix);
+        }
+
         bool hitTest(const ovrPosef& ray, const ovrPosef& quadCenter, const ovrVector2f& quadSize, ovrPosef& hitPose) {
             // Taken from
             // https://github.com/microsoft/OpenXR-MixedReality/blob/main/samples/SceneUnderstandingUwp/Scene_Placement.cpp
 
-            // Clockwise order
-            const float halfWidth = quadSize.x / 2.0f;
-            const float halfHeight = quadSize.y / 2.0f;
-            auto v0 = XMVectorSet(-halfWidth, -halfHeight, 0, 1);
-            auto v1 = XMVectorSet(-halfWidth, halfHeight, 0, 1);
-            auto v2 = XMVectorSet(halfWidth, halfHeight, 0, 1);
-            auto v3 = XMVectorSet(halfWidth, -halfHeight, 0, 1);
-            const auto matrix = LoadOvrPose(quadCenter);
-            v0 = XMVector4Transform(v0, matrix);
-            v1 = XMVector4Transform(v1, matrix);
-            v2 = XMVector4Transform(v2, matrix);
-            v3 = XMVector4Transform(v3, matrix);
+            XMVECTOR v[4];
+            getQuadCorners(quadCenter, quadSize, v);
 
             const XMVECTOR rayPosition = LoadOvrVector3(ray.Position);
 
@@ -409,7 +1577,184 @@ namespace {
             const XMVECTOR rayDirection = XMVector3Rotate(forward, rotation);
 
             float distance = 0.0f;
-            return rayIntersectQuad(rayPosition, rayDirection, v0, v1, v2, v3, &hitPose, distance);
+            return rayIntersectQuad(rayPosition, rayDirection, v[0], v[1], v[2], v[3], &hitPose, distance);
+        }
+
+        // A quad prepared for testing against many rays. The axes are divided by the half size of the quad, so that
+        // the hit is within the quad when both coordinates are within [-1, 1].
+        struct HitPlane {
+            XMFLOAT3 center;
+            XMFLOAT3 normal;
+            XMFLOAT3 right;
+            XMFLOAT3 up;
+        };
+
+        inline HitPlane getHitPlane(const ovrPosef& quadCenter, const ovrVector2f& quadSize) {
+            const auto rotation = LoadOvrQuaternion(quadCenter.Orientation);
+            HitPlane plane;
+            plane.center = {quadCenter.Position.x, quadCenter.Position.y, quadCenter.Position.z};
+            XMStoreFloat3(&plane.normal, XMVector3Rotate(XMVectorSet(0, 0, 1, 0), rotation));
+            XMStoreFloat3(&plane.right,
+                          XMVectorScale(XMVector3Rotate(XMVectorSet(1, 0, 0, 0), rotation), 2.f / quadSize.x));
+            XMStoreFloat3(&plane.up,
+                          XMVectorScale(XMVector3Rotate(XMVectorSet(0, 1, 0, 0), rotation), 2.f / quadSize.y));
+            return plane;
+        }
+
+        // The hit planes of many quads, stored as structure of arrays so that 4 quads are tested at once.
+        class HitPlanes {
+          public:
+            void clear() {
+                for (auto& component : m_components) {
+                    component.clear();
+                }
+                m_count = 0;
+            }
+
+            void push_back(const HitPlane& plane) {
+                const float values[] = {plane.center.x,
+                                        plane.center.y,
+                                        plane.center.z,
+                                        plane.normal.x,
+                                        plane.normal.y,
+                                        plane.normal.z,
+                                        plane.right.x,
+                                        plane.right.y,
+                                        plane.right.z,
+                                        plane.up.x,
+                                        plane.up.y,
+                                        plane.up.z};
+                // Keep the arrays padded to a multiple of 4, with a null normal that never hits.
+                if (m_count % 4 == 0) {
+                    for (auto& component : m_components) {
+                        component.resize(m_count + 4, 0.f);
+                    }
+                }
+                for (size_t i = 0; i < std::size(values); i++) {
+                    m_components[i][m_count] = values[i];
+                }
+                m_count++;
+            }
+
+            size_t size() const {
+                return m_count;
+            }
+
+            // Test a ray against all the quads. hits[i] is set when quad i is hit, in front of the ray.
+            void hitTest(const ovrPosef& ray, std::vector<uint8_t>& hits) const {
+                const XMVECTOR rayDirection =
+                    XMVector3Rotate(XMVectorSet(0, 0, -1, 0), LoadOvrQuaternion(ray.Orientation));
+                const XMVECTOR ox = XMVectorReplicate(ray.Position.x);
+                const XMVECTOR oy = XMVectorReplicate(ray.Position.y);
+                const XMVECTOR oz = XMVectorReplicate(ray.Position.z);
+                const XMVECTOR dx = XMVectorSplatX(rayDirection);
+                const XMVECTOR dy = XMVectorSplatY(rayDirection);
+                const XMVECTOR dz = XMVectorSplatZ(rayDirection);
+                const XMVECTOR one = XMVectorSplatOne();
+
+                hits.assign(m_components[0].size(), 0);
+                for (size_t i = 0; i < m_count; i += 4) {
+                    const auto load = [&](size_t component) {
+                        return XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&m_components[component][i]));
+                    };
+                    const auto dot = [](XMVECTOR ax, XMVECTOR ay, XMVECTOR az, XMVECTOR bx, XMVECTOR by, XMVECTOR bz) {
+                        return XMVectorMultiplyAdd(ax, bx, XMVectorMultiplyAdd(ay, by, XMVectorMultiply(az, bz)));
+                    };
+
+                    // Distance along the ray to the plane.
+                    const XMVECTOR nx = load(3), ny = load(4), nz = load(5);
+                    const XMVECTOR cx = XMVectorSubtract(load(0), ox);
+                    const XMVECTOR cy = XMVectorSubtract(load(1), oy);
+                    const XMVECTOR cz = XMVectorSubtract(load(2), oz);
+                    const XMVECTOR denominator = dot(nx, ny, nz, dx, dy, dz);
+                    const XMVECTOR t = XMVectorDivide(dot(nx, ny, nz, cx, cy, cz), denominator);
+
+                    // The hit, relative to the center of the quad, in the axes of the quad.
+                    const XMVECTOR px = XMVectorSubtract(XMVectorMultiply(dx, t), cx);
+                    const XMVECTOR py = XMVectorSubtract(XMVectorMultiply(dy, t), cy);
+                    const XMVECTOR pz = XMVectorSubtract(XMVectorMultiply(dz, t), cz);
+                    const XMVECTOR u = dot(load(6), load(7), load(8), px, py, pz);
+                    const XMVECTOR v = dot(load(9), load(10), load(11), px, py, pz);
+
+                    // Comparisons with NaN (parallel ray or padding) are false.
+                    const XMVECTOR isHit = XMVectorAndInt(
+                        XMVectorAndInt(XMVectorGreaterOrEqual(t, XMVectorZero()), XMVectorInBounds(u, one)),
+                        XMVectorInBounds(v, one));
+                    XMUINT4 mask;
+                    XMStoreUInt4(&mask, isHit);
+                    hits[i] = mask.x != 0;
+                    hits[i + 1] = mask.y != 0;
+                    hits[i + 2] = mask.z != 0;
+                    hits[i + 3] = mask.w != 0;
+                }
+            }
+
+          private:
+            // Center, normal, right and up axes.
+            std::vector<float> m_components[12];
+            size_t m_count{0};
+        };
+
+        // Whether a quad (in the space of the view, looking down -Z) is entirely outside of the field of view. This is
+        // conservative: the quad is only culled when all its corners are outside of the same plane.
+        bool isQuadOutsideFrustum(const ovrPosef& quadCenter, const ovrVector2f& quadSize, const ovrFovPort& fov) {
+            XMVECTOR corners[4];
+            getQuadCorners(quadCenter, quadSize, corners);
+
+            // The planes go through the eye, with their normal pointing out of the frustum.
+            const XMVECTOR planes[] = {
+                XMVectorSet(-1, 0, fov.LeftTan, 0),
+                XMVectorSet(1, 0, fov.RightTan, 0),
+                XMVectorSet(0, 1, fov.UpTan, 0),
+                XMVectorSet(0, -1, fov.DownTan, 0),
+                XMVectorSet(0, 0, 1, 0),
+            };
+            for (const auto& plane : planes) {
+                bool isOutside = true;
+                for (const auto& corner : corners) {
+                    if (XMVectorGetX(XMVector3Dot(plane, corner)) <= 0.f) {
+                        isOutside = false;
+                        break;
+                    }
+                }
+                if (isOutside) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // Whether a quad is entirely hidden behind another quad, as seen from both eyes (in the space of the view).
+        bool isQuadOccluded(const ovrPosef& quadCenter,
+                            const ovrVector2f& quadSize,
+                            const ovrPosef& occluderCenter,
+                            const ovrVector2f& occluderSize,
+                            float eyeOffset) {
+            XMVECTOR corners[4], occluderCorners[4];
+            getQuadCorners(quadCenter, quadSize, corners);
+            getQuadCorners(occluderCenter, occluderSize, occluderCorners);
+
+            // Both quads are convex: it is enough for the corners to be hidden.
+            for (const float x : {-eyeOffset, eyeOffset}) {
+                const XMVECTOR eye = XMVectorSet(x, 0, 0, 1);
+                for (const auto& corner : corners) {
+                    const XMVECTOR toCorner = XMVectorSubtract(corner, eye);
+                    const float cornerDistance = XMVectorGetX(XMVector3Length(toCorner));
+                    float distance = 0.f;
+                    if (!rayIntersectQuad(eye,
+                                          XMVector3Normalize(toCorner),
+                                          occluderCorners[0],
+                                          occluderCorners[1],
+                                          occluderCorners[2],
+                                          occluderCorners[3],
+                                          nullptr,
+                                          distance) ||
+                        distance >= cornerDistance) {
+                        return false;
+                    }
+                }
+            }
+            return true;
         }
 
         // https://gamedev.stackexchange.com/questions/136652/uv-world-mapping-in-shader-with-unity/136720#136720
@@ -443,47 +1788,87 @@ namespace {
             return {static_cast<LONG>(uv.x * quadPixelSize.w), static_cast<LONG>(uv.y * quadPixelSize.h)};
         }
 
-    } // namespace geom
-#pragma endregion
-
-#pragma region Transparency Shader
-    const std::string_view TransparencyShaderHlsl =
-        R"_(
-cbuffer config : register(b0) {
-    float3 TransparentColor;
-    float Alpha;
-};
-Texture2D in_texture : register(t0);
-RWTexture2D<float4> out_texture : register(u0);
-
-[numthreads(32, 32, 1)]
-void main(uint2 pos : SV_DispatchThreadID)
-{
-    float a = 1.f;
-    if (all(TransparentColor == float3(-1.f, -1.f, -1.f)) || all(in_texture[pos].rgb == TransparentColor)) {
-        a = Alpha;
-    }
-    // Make sure to premultiply RGB by alpha.
-    out_texture[pos] = float4(in_texture[pos].rgb * a, a);
-}
-    )_";
+        // A section of a cylinder around the Y axis, centered on the -Z axis of its pose, and seen from the inside.
+        struct Cylinder {
+            OVR::Posef center;
+            OVR::Posef centerInverse;
+            float radius{0.f};
+            float angle{0.f};
+            float height{0.f};
+        };
 
-    struct TransparencyShaderConstants {
-        ovrVector3f transparentColor;
-        float alpha;
-    };
+        // Bend a quad into a cylinder of the same width and height, preserving the center of the quad.
+        void updateCylinder(Cylinder& cylinder, const ovrPosef& quadCenter, const ovrVector2f& quadSize, float angle) {
+            cylinder.radius = quadSize.x / angle;
+            cylinder.angle = angle;
+            cylinder.height = quadSize.y;
+            cylinder.center = OVR::Posef(quadCenter) * OVR::Posef(OVR::Quatf::Identity(), {0, 0, cylinder.radius});
+            cylinder.centerInverse = cylinder.center.Inverted();
+        }
 
-#pragma endregion
+        // Intersect a ray with a cylinder, with the width and height of the section to test (which may include a
+        // margin).
+        bool hitTest(const ovrPosef& ray, const Cylinder& cylinder, const ovrVector2f& size, ovrPosef& hitPose) {
+            const OVR::Vector3f origin = cylinder.centerInverse.Transform(ray.Position);
+            const OVR::Vector3f direction =
+                (cylinder.centerInverse.Rotation * OVR::Quatf(ray.Orientation)).Rotate({0, 0, -1});
+
+            // Solve |origin.xz + t * direction.xz| = radius.
+            const float a = direction.x * direction.x + direction.z * direction.z;
+            const float b = 2.f * (origin.x * direction.x + origin.z * direction.z);
+            const float c = origin.x * origin.x + origin.z * origin.z - cylinder.radius * cylinder.radius;
+            const float discriminant = b * b - 4.f * a * c;
+            if (cylinder.radius <= 0.f || a < FLT_EPSILON || discriminant < 0.f) {
+                return false;
+            }
 
-    // Definitions for the memory-mapped file structures.
-    namespace shared {
+            const float halfAngle = size.x / cylinder.radius / 2.f;
+            const float sqrtDiscriminant = std::sqrt(discriminant);
+            for (const float t : {(-b - sqrtDiscriminant) / (2.f * a), (-b + sqrtDiscriminant) / (2.f * a)}) {
+                if (t < 0.f) {
+                    continue;
+                }
+                const OVR::Vector3f point = origin + direction * t;
+                const float theta = std::atan2(point.x, -point.z);
+                if (std::abs(theta) <= halfAngle && std::abs(point.y) <= size.y / 2.f) {
+                    // Face the center of the cylinder, like the quad the cylinder was bent from.
+                    hitPose = cylinder.center * OVR::Posef(OVR::Quatf(OVR::Vector3f(0, 1, 0), -theta), point);
+                    return true;
+                }
+            }
+            return false;
+        }
 
-        struct Vector3 {
-            float x, y, z;
-        };
+        ovrVector2f getUVCoordinates(const ovrVector3f& point, const Cylinder& cylinder) {
+            const OVR::Vector3f local = cylinder.centerInverse.Transform(point);
+            const float theta = std::atan2(local.x, -local.z);
+            return {theta / cylinder.angle + 0.5f, -local.y / cylinder.height + 0.5f};
+        }
 
-        struct Quaternion {
-            float x, y, z, w;
+        inline POINT getUVCoordinates(const ovrVector3f& point,
+                                      const Cylinder& cylinder,
+                                      const ovrSizei& quadPixelSize) {
+            const ovrVector2f uv = getUVCoordinates(point, cylinder);
+            return {static_cast<LONG>(uv.x * quadPixelSize.w), static_cast<LONG>(uv.y * quadPixelSize.h)};
+        }
+
+        // The size of a quad at the center of the cylinder covering the same field of view, seen from the axis.
+        ovrVector2f getBoundingQuadSize(const Cylinder& cylinder) {
+            return {2.f * cylinder.radius * std::tan(cylinder.angle / 2.f), cylinder.height};
+        }
+
+    } // namespace geom
+#pragma endregion
+
+    // Definitions for the memory-mapped file structures.
+    namespace shared {
+
+        struct Vector3 {
+            float x, y, z;
+        };
+
+        struct Quaternion {
+            float x, y, z, w;
         };
 
         struct Pose {
@@ -491,10 +1876,26 @@ void main(uint2 pos : SV_DispatchThreadID)
             Vector3 position;
         };
 
-        static constexpr int OverlayCount = 4;
+        // Must be bumped whenever the layout below changes.
+        static constexpr uint32_t OverlayStateVersion = 8;
+
+        // The largest capacity accepted from the ShellApp (one bit per slot in activeSlots).
+        static constexpr uint32_t MaxOverlayCount = 64;
+
+        // The header at the beginning of the memory mapped file, followed by capacity OverlayState.
+        struct OverlayStateHeader {
+            uint32_t version;
+            uint32_t capacity;
+            // Bit N is set when slot N holds a window. Set after the slot is filled, cleared after it is emptied.
+            uint64_t activeSlots;
+            // Incremented by the ShellApp after any of the slots was written.
+            uint32_t changeCount;
+            uint32_t reserved;
+        };
 
         struct OverlayState {
             uint64_t handle;
+            // Written by OVRlay only (like scale and isMinimized).
             Pose pose;
             float scale;
             uint8_t isMonitor;
@@ -503,10 +1904,195 @@ void main(uint2 pos : SV_DispatchThreadID)
             uint8_t isInteractable;
             uint8_t isFrozen;
             uint8_t isMinimized;
+            uint8_t isColorKeyed;
+            uint8_t colorKeyTolerance;
+            uint32_t colorKey;
+            // Incremented by the ShellApp every time the slot is assigned or released.
+            uint32_t generation;
+
+            // Seqlocks for the fields written by the ShellApp (everything but the fields below), and for the fields
+            // written by OVRlay (pose, scale, isMinimized and poseGeneration).
+            uint32_t shellAppSequence;
+            uint32_t ovrlaySequence;
+
+            // The generation of the window that pose, scale and isMinimized belong to. A window imported by the
+            // ShellApp gets a new generation, which tells OVRlay to place it again.
+            uint32_t poseGeneration;
+
+            // The rate at which the content is updated, in Hz (0 for every frame).
+            uint32_t refreshRate;
+
+            // The angle covered by the overlay, in degrees (0 for flat).
+            uint32_t curvature;
+
+            // Incremented by the ShellApp to take a new snapshot, for overlays in snapshot mode (only captured once).
+            uint32_t snapshotRequest;
+            uint8_t isSnapshot;
+        };
+
+        // An odd sequence means that a write is in progress. Readers never wait: they try again on a later frame.
+        inline void beginWrite(uint32_t& sequence) {
+            WriteNoFence(reinterpret_cast<volatile LONG*>(&sequence), sequence + 1);
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+
+        inline void endWrite(uint32_t& sequence) {
+            WriteRelease(reinterpret_cast<volatile LONG*>(&sequence), sequence + 1);
+        }
+
+        // Copy the slot (or the statistics), and tell whether the fields guarded by the sequence were copied without
+        // tearing.
+        template <typename T>
+        inline bool tryRead(const T& state, const uint32_t& sequence, T& snapshot) {
+            const LONG before = ReadAcquire(reinterpret_cast<const volatile LONG*>(&sequence));
+            if (before & 1) {
+                return false;
+            }
+            snapshot = state;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return ReadNoFence(reinterpret_cast<const volatile LONG*>(&sequence)) == before;
+        }
+
+        // Timings in milliseconds.
+        struct TimingStats {
+            float min;
+            float avg;
+            float p99;
+        };
+
+        struct OverlayStats {
+            // Seqlock for the whole block, written by OVRlay.
+            uint32_t sequence;
+            uint64_t frameCount;
+            TimingStats sortWindows;
+            TimingStats handleInteractions;
+            TimingStats updateWindows;
+            uint32_t overlayCount;
+            TimingStats gpuTime[MaxOverlayCount];
         };
 
     } // namespace shared
 
+#pragma region "Statistics"
+    // Rolling statistics over a fixed window of samples, without allocations.
+    class RollingStatistics {
+      public:
+        static constexpr uint32_t SampleCount = 128;
+
+        void addSample(float value) {
+            m_samples[m_next] = value;
+            m_next = (m_next + 1) % SampleCount;
+            m_count = std::min(m_count + 1, SampleCount);
+        }
+
+        void reset() {
+            m_next = m_count = 0;
+        }
+
+        shared::TimingStats compute() {
+            if (!m_count) {
+                return {};
+            }
+
+            std::copy_n(m_samples.cbegin(), m_count, m_sorted.begin());
+            const auto end = m_sorted.begin() + m_count;
+            const auto p99 = m_sorted.begin() + std::min((m_count * 99) / 100, m_count - 1);
+            std::nth_element(m_sorted.begin(), p99, end);
+
+            shared::TimingStats stats{};
+            stats.p99 = *p99;
+            stats.min = *std::min_element(m_sorted.begin(), end);
+            float sum = 0.f;
+            for (auto it = m_sorted.begin(); it != end; ++it) {
+                sum += *it;
+            }
+            stats.avg = sum / m_count;
+            return stats;
+        }
+
+      private:
+        std::array<float, SampleCount> m_samples{};
+        std::array<float, SampleCount> m_sorted{};
+        uint32_t m_next{0};
+        uint32_t m_count{0};
+    };
+
+    inline int64_t getQpcTime() {
+        LARGE_INTEGER counter;
+        QueryPerformanceCounter(&counter);
+        return counter.QuadPart;
+    }
+#pragma endregion
+
+#pragma region "AtlasAllocator"
+    // Packs rectangles into horizontal shelves of a texture. The space of a shelf is reclaimed once all its
+    // rectangles were freed.
+    class AtlasAllocator {
+      public:
+        // Rectangles are allocated in steps, so that shelves can be shared by rectangles of similar heights.
+        static constexpr int Granularity = 32;
+
+        AtlasAllocator(const ovrSizei& size) : m_size(size) {
+        }
+
+        std::optional<ovrRecti> allocate(const ovrSizei& size) {
+            const int width = roundUp(size.w, Granularity);
+            const int height = roundUp(size.h, Granularity);
+            if (width > m_size.w || height > m_size.h) {
+                return {};
+            }
+
+            // Use the lowest shelf with room, without wasting more than half of its height.
+            auto best = m_shelves.end();
+            for (auto it = m_shelves.begin(); it != m_shelves.end(); ++it) {
+                if (it->height >= height && it->height <= 2 * height && m_size.w - it->usedWidth >= width &&
+                    (best == m_shelves.end() || it->height < best->height)) {
+                    best = it;
+                }
+            }
+            if (best == m_shelves.end()) {
+                if (m_usedHeight + height > m_size.h) {
+                    return {};
+                }
+                best = m_shelves.insert(m_shelves.end(), Shelf{m_usedHeight, height, 0, 0});
+                m_usedHeight += height;
+            }
+
+            const ovrRecti rect{{best->usedWidth, best->y}, {width, height}};
+            best->usedWidth += width;
+            best->count++;
+            return rect;
+        }
+
+        void free(const ovrRecti& rect) {
+            const auto it = std::find_if(
+                m_shelves.begin(), m_shelves.end(), [&](const Shelf& shelf) { return shelf.y == rect.Pos.y; });
+            if (it == m_shelves.end() || --it->count) {
+                return;
+            }
+
+            it->usedWidth = 0;
+            // Give back the height of the empty shelves at the top.
+            while (!m_shelves.empty() && !m_shelves.back().count) {
+                m_usedHeight -= m_shelves.back().height;
+                m_shelves.pop_back();
+            }
+        }
+
+      private:
+        struct Shelf {
+            int y;
+            int height;
+            int usedWidth;
+            uint32_t count;
+        };
+
+        const ovrSizei m_size;
+        std::vector<Shelf> m_shelves;
+        int m_usedHeight{0};
+    };
+#pragma endregion
+
     class OverlayManager {
       private:
         // The threshold for considering a trigger event to be a click.
@@ -538,11 +2124,93 @@ void main(uint2 pos : SV_DispatchThreadID)
         // The multiplier for mouse wheel events when scrolling inside a window.
         static constexpr float WheelMultiplier = 0.5f;
 
+        // The approximate angular resolution of the headset panels, to estimate the pixel footprint of an overlay.
+        static constexpr float PanelPixelsPerRadian = 1200.f;
+
+        // The largest downscale factor applied to distant or small overlays.
+        static constexpr uint32_t MaxDownscale = 4;
+
+        // How far past a threshold the footprint must go before changing the downscale factor (and the swapchain).
+        static constexpr float DownscaleHysteresis = 1.25f;
+
+        // Swapchains are allocated in steps, so that they can absorb resizes of the window.
+        static constexpr int SwapchainSizeGranularity = 256;
+
+        // The number of unused swapchains kept for reuse.
+        static constexpr size_t MaxPooledSwapchains = 4;
+
+        // The size of the atlas shared by the small windows, and the largest window content placed in the atlas.
+        static constexpr ovrSizei AtlasSize = {2048, 2048};
+        static constexpr int AtlasMaxItemSize = 512;
+
+        // The largest divider applied to the refresh rate of the overlays when over the GPU budget.
+        static constexpr uint32_t MaxThrottle = 8;
+
+        // The number of frames between two adjustments of the throttling, and the fraction of the GPU budget under
+        // which the throttling is relaxed.
+        static constexpr uint32_t GpuBudgetInterval = 30;
+        static constexpr float GpuBudgetRelaxThreshold = 0.75f;
+
+        // The largest angle covered by a curved window (radians). Past this, the window would wrap around the user.
+        static constexpr float MaxCurvature = (float)MATH_DOUBLE_TWOPI / 3;
+
+        // The margin added around the field of view when culling windows, so that they are refreshed before coming
+        // back into view (radians).
+        static constexpr float CullingGuardBand = 0.2f;
+
+        // The field of view assumed when the runtime does not tell it (tangent of the half-angles).
+        static constexpr float DefaultFovTan = 1.5f;
+
+        // Half the distance between the eyes, for occlusion culling.
+        static constexpr float EyeOffset = 0.035f;
+
+        // The number of frames of latency for reading back the GPU timers.
+        static constexpr uint32_t GpuTimerLatency = 4;
+
+        // The number of frames between two updates of the statistics published in the memory mapped file.
+        static constexpr uint32_t StatsPublishInterval = 10;
+
+        // The number of consecutive errors after which the composition thread gives up, and the render thread does
+        // the composition instead.
+        static constexpr uint32_t MaxCompositionErrors = 10;
+
+        // The delay before creating again a capture that failed, doubled with every failure (in seconds).
+        static constexpr double MinCaptureRetryDelay = 0.5;
+        static constexpr double MaxCaptureRetryDelay = 30.0;
+
         enum class WindowPlacement {
             WorldLocked = 0,
             HeadLocked,
         };
 
+        // A swapchain for a window and the resources to access it from the composition device.
+        struct WindowSwapchain {
+            ovrTextureSwapChain handle{nullptr};
+            ovrSizei size{};
+            DXGI_FORMAT format{DXGI_FORMAT_UNKNOWN};
+            std::vector<ComPtr<ID3D11Texture2D>> imagesOnCompositionDevice;
+            std::vector<ComPtr<ID3D11Texture2D>> imagesOnSubmissionDevice;
+            // Views for the transparency shader.
+            std::vector<ComPtr<ID3D11UnorderedAccessView>> viewsOnCompositionDevice;
+            // For each image, the region of the content that changed since it was last written (in capture surface
+            // coordinates).
+            std::vector<RECT> damage;
+            // A static swapchain holds a single image, that can only be committed once.
+            bool isStatic{false};
+            bool isCommitted{false};
+        };
+
+        // Whether a swapchain can hold the content without wasting too much memory.
+        inline bool fitsSwapchain(const WindowSwapchain& swapchain,
+                                  const ovrSizei& size,
+                                  DXGI_FORMAT format,
+                                  bool isStatic) {
+            return swapchain.handle && swapchain.isStatic == isStatic && !(isStatic && swapchain.isCommitted) &&
+                   swapchain.format == format && swapchain.size.w >= size.w &&
+                   swapchain.size.h >= size.h && swapchain.size.w <= 2 * roundUp(size.w, SwapchainSizeGranularity) &&
+                   swapchain.size.h <= 2 * roundUp(size.h, SwapchainSizeGranularity);
+        }
+
         // The state of each window, including what is needed for interactions and display.
         struct Window {
             ~Window() {
@@ -558,22 +2226,68 @@ void main(uint2 pos : SV_DispatchThreadID)
             void Clear() {
                 quad = {};
                 captureWindow.reset();
-                swapchainImagesOnSubmissionDevice.clear();
-                swapchainImagesOnCompositionDevice.clear();
-                if (swapchain) {
-                    m_dispatchTable.ovr_DestroyTextureSwapChain(m_ovrSession, swapchain);
-                    swapchain = nullptr;
-                }
+                lastContentSize = {};
+                lastFrameGeneration = 0;
+                lastOpacity = -1.f;
+                isDirty = false;
+                dirtySwapchain = nullptr;
+                readyFenceValue = 0;
+                contentViewport = {};
+                hasSwapchainRequest = false;
+                hasCaptureRequest = false;
+                nextCaptureRetryTime = 0;
+                captureRetryDelay = 0;
+                isDirectCapture = false;
+                captureFormat = DXGI_FORMAT_UNKNOWN;
+                colorScale = 1.f;
+                hdrColorScale = 0.f;
+                outputMonitor = nullptr;
+                throttle = 1;
+                nextUpdateTime = 0;
+                curvature = 0.f;
+                isSnapshot = false;
+                isSnapshotRequested = false;
+                nextSnapshotTime = 0;
+                captureSize = {};
+                isInAtlas = false;
+                isAtlasContentReady = false;
+                atlasRect.reset();
+                atlasDamage.clear();
+                cylinderSource = {};
+                hitPlaneSize = {};
+                cylinder = {};
+                isSorted = false;
+                downscale = 1;
+                surfaceViews.clear();
+                DestroySwapchain(swapchain);
+                DestroySwapchain(retiredSwapchain);
             }
 
+            // The capture might still be pending creation for a valid window.
             bool IsValid() const {
-                return quad.Header.Type == ovrLayerType_Quad && captureWindow;
+                return quad.Header.Type == ovrLayerType_Quad;
             }
 
             HWND hwnd{nullptr};
             HMONITOR monitor{nullptr};
 
             std::unique_ptr<CaptureWindow> captureWindow;
+            // The size of the captured window, which remains known after the capture of a snapshot was released.
+            ovrSizei captureSize{};
+            // Whether the capture is on the submission device, in which case the content is copied on the render
+            // thread right before being committed.
+            bool isDirectCapture{false};
+            // A new capture is being created in the background. In the meantime, the previous capture remains in use.
+            bool hasCaptureRequest{false};
+            // The creation of the capture failed, and is requested again at that time (QPC time).
+            int64_t nextCaptureRetryTime{0};
+            int64_t captureRetryDelay{0};
+            // The format of the capture, and the scale applied to its colors.
+            DXGI_FORMAT captureFormat{DXGI_FORMAT_UNKNOWN};
+            float colorScale{1.f};
+            // The SDR white scale if the window is on an HDR output, 0 otherwise, and the monitor of that output.
+            float hdrColorScale{0.f};
+            HMONITOR outputMonitor{nullptr};
 
             float scale{1.f};
             float opacity{1.f};
@@ -581,61 +2295,304 @@ void main(uint2 pos : SV_DispatchThreadID)
             bool isInteractable{true};
             bool isFrozen{false};
             bool isMinimized{false};
+            bool isColorKeyed{false};
+            uint32_t colorKey{0};
+            uint8_t colorKeyTolerance{0};
+            // The refresh rate requested by the ShellApp (0 for every frame), and the divider applied to it when over
+            // the GPU budget.
+            uint32_t refreshRate{0};
+            uint32_t throttle{1};
+            // The earliest time the content may be copied again (QPC time).
+            int64_t nextUpdateTime{0};
+            // In snapshot mode, the capture is released once the content was committed to a static swapchain. A new
+            // snapshot is taken on request from the ShellApp or when the next snapshot time is reached (QPC time).
+            bool isSnapshot{false};
+            uint32_t snapshotRequest{0};
+            bool isSnapshotRequested{false};
+            int64_t nextSnapshotTime{0};
 
             bool hasFocus{false};
 
-            ovrTextureSwapChain swapchain{nullptr};
-            ovrSizei swapchainSize{};
-            std::vector<ComPtr<ID3D11Texture2D>> swapchainImagesOnCompositionDevice;
-            std::vector<ComPtr<ID3D11Texture2D>> swapchainImagesOnSubmissionDevice;
-
-            // TODO: Support cylinder as well.
+            // The generation of the slot when the window was opened, to detect reuse of the slot.
+            uint32_t generation{0};
+            // Whether the window is part of the sorted windows for this frame.
+            bool isSorted{false};
+            // The pose of the quad relative to the head, for culling.
+            ovrPosef quadPoseInView{};
+
+            // The swapchain may be larger than the content, which is then described by the viewport.
+            WindowSwapchain swapchain;
+            // The downscale factor wanted for the current footprint.
+            uint32_t downscale{1};
+
+            // Views for the transparency shader. The capture surfaces are recycled by the frame pool, so we cache
+            // one view per pooled buffer.
+            std::vector<std::pair<ComPtr<ID3D11Texture2D>, ComPtr<ID3D11ShaderResourceView>>> surfaceViews;
+
+            // The size of the captured content, to detect when the window geometry must be refreshed.
+            ovrSizei lastContentSize{};
+
+            // The capture frame generation and opacity last copied into the swapchain.
+            uint64_t lastFrameGeneration{0};
+            float lastOpacity{-1.f};
+            // Whether a swapchain image was written and must be signaled, and the swapchain it belongs to.
+            bool isDirty{false};
+            ovrTextureSwapChain dirtySwapchain{nullptr};
+            // The fence value to wait for before committing the swapchain image (0 when nothing to commit).
+            uint64_t readyFenceValue{0};
+            // The viewport corresponding to the content of the image to commit.
+            ovrRecti contentViewport{};
+            // A new swapchain is being created in the background. In the meantime, the previous swapchain remains
+            // displayed, and it is retired once the new one is committed.
+            bool hasSwapchainRequest{false};
+            WindowSwapchain retiredSwapchain;
+            // Identifies the window for the resources created in the background.
+            uint64_t stagingId{0};
+
+            // Small windows are copied into a region of the shared atlas instead of their own swapchain. A window
+            // leaving the atlas keeps its region until its own swapchain was committed.
+            bool isInAtlas{false};
+            bool isAtlasContentReady{false};
+            std::optional<ovrRecti> atlasRect;
+            // For each atlas image, the region of the content that changed since it was last written.
+            std::vector<RECT> atlasDamage;
+
+            // The quad holds the state of the layer. A curved window is submitted as a cylinder bent from the quad.
             ovrLayerQuad quad{};
 
+            // The angle covered by the window (radians, 0 for flat), and the cached cylinder. The cylinder is only
+            // recomputed when the quad it was bent from moved or changed size.
+            float curvature{0.f};
+            ovrLayerQuad cylinderSource{};
+            geom::Cylinder cylinderGeometry;
+            ovrLayerCylinder cylinder{};
+
+            // The quad used for hit testing, including a margin around the window. It is only recomputed when the
+            // window moved or changed size.
+            ovrPosef hitPlanePose{};
+            ovrVector2f hitPlaneSize{};
+            geom::HitPlane hitPlane{};
+
+            // Minimized windows are always displayed as a flat icon.
+            bool IsCurved() const {
+                return curvature > 0.f && !isMinimized;
+            }
+
           private:
+            void DestroySwapchain(WindowSwapchain& swapchain) {
+                if (swapchain.handle) {
+                    m_dispatchTable.ovr_DestroyTextureSwapChain(m_ovrSession, swapchain.handle);
+                }
+                swapchain = {};
+            }
+
             ovrSession m_ovrSession{nullptr};
             ovrDispatchTable m_dispatchTable;
         };
 
+        // GPU timers for each window's copy on the composition device.
+        struct GpuTimer {
+            ComPtr<ID3D11Query> disjoint;
+            std::vector<ComPtr<ID3D11Query>> start;
+            std::vector<ComPtr<ID3D11Query>> end;
+            std::vector<uint32_t> usedSlots;
+            bool isPending{false};
+        };
+
+        // A copy of the content of a window into a swapchain image (or the atlas), queued while looking at the windows
+        // and recorded later. It holds references on everything it uses, so that with asynchronous composition, the
+        // render thread is free to change the windows while the copies are recorded.
+        struct QueuedCopy {
+            uint32_t slot{0};
+            ComPtr<ID3D11Texture2D> surface;
+            D3D11_BOX region{};
+            ComPtr<ID3D11Texture2D> image;
+            ovrVector2i destination{};
+            // Null to copy without transparency.
+            ID3D11ComputeShader* shader{nullptr};
+            ComPtr<ID3D11ShaderResourceView> surfaceView;
+            ComPtr<ID3D11UnorderedAccessView> view;
+            TransparencyShaderConstants transparency{};
+        };
+
+        // Resources created in the background for a window, and swapped in at the next frame boundary.
+        struct StagingWork {
+            uint32_t slot{0};
+            uint64_t stagingId{0};
+
+            // Request.
+            HWND hwnd{nullptr};
+            HMONITOR monitor{nullptr};
+            bool isDirectCapture{false};
+            DXGI_FORMAT captureFormat{DXGI_FORMAT_UNKNOWN};
+            bool isSwapchainRequest{false};
+            D3D11_TEXTURE2D_DESC swapchainDesc{};
+            bool isStaticSwapchain{false};
+
+            // Result.
+            std::unique_ptr<CaptureWindow> captureWindow;
+            WindowSwapchain swapchain;
+        };
+
       public:
         OverlayManager() {
             *m_overlayStateFile.put() = OpenFileMapping(FILE_MAP_READ | FILE_MAP_WRITE, false, L"OVRlay.OverlayState");
             if (!m_overlayStateFile) {
-                Log("Failed to open memory-mapped file.\n");
+                LogError("Failed to open memory-mapped file.\n");
                 return;
             }
 
-            m_overlayState = reinterpret_cast<shared::OverlayState*>(MapViewOfFile(
-                m_overlayStateFile.get(), FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, sizeof(shared::OverlayState)));
-            if (!m_overlayState) {
-                Log("Failed to map memory-mapped file.\n");
+            // The ShellApp decides of the capacity: map the header first, then the entire state.
+            {
+                const auto header = reinterpret_cast<shared::OverlayStateHeader*>(MapViewOfFile(
+                    m_overlayStateFile.get(), FILE_MAP_READ, 0, 0, sizeof(shared::OverlayStateHeader)));
+                if (!header) {
+                    LogError("Failed to map memory-mapped file.\n");
+                    return;
+                }
+                const uint32_t version = header->version;
+                m_capacity = header->capacity;
+                UnmapViewOfFile(header);
+
+                if (version != shared::OverlayStateVersion || !m_capacity || m_capacity > shared::MaxOverlayCount) {
+                    LogError("Unsupported memory-mapped file (version %u, capacity %u).\n", version, m_capacity);
+                    return;
+                }
+            }
+            m_overlayStateHeader = reinterpret_cast<shared::OverlayStateHeader*>(
+                MapViewOfFile(m_overlayStateFile.get(),
+                              FILE_MAP_READ | FILE_MAP_WRITE,
+                              0,
+                              0,
+                              sizeof(shared::OverlayStateHeader) + m_capacity * sizeof(shared::OverlayState)));
+            if (!m_overlayStateHeader) {
+                LogError("Failed to map memory-mapped file.\n");
                 return;
             }
+            m_overlayState = reinterpret_cast<shared::OverlayState*>(m_overlayStateHeader + 1);
+            Log("Overlay capacity: %u\n", m_capacity);
+
+            m_windows = std::make_unique<Window[]>(m_capacity);
+            m_gpuTimeStats.resize(m_capacity);
+
+            // Avoid allocations during the frame.
+            m_activeSlots.reserve(m_capacity);
+            m_stagingRequests.reserve(2 * m_capacity);
+            m_stagingResults.reserve(2 * m_capacity);
+            m_collectedResults.reserve(2 * m_capacity);
+            m_sortedWindows.reserve(m_capacity);
+            m_sortedWindowsDistances.reserve(m_capacity);
+
+            // The statistics are optional: failure is not fatal.
+            *m_overlayStatsFile.put() = CreateFileMapping(
+                INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, sizeof(shared::OverlayStats), L"OVRlay.OverlayStats");
+            if (m_overlayStatsFile) {
+                m_overlayStats = reinterpret_cast<shared::OverlayStats*>(MapViewOfFile(
+                    m_overlayStatsFile.get(), FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, sizeof(shared::OverlayStats)));
+            }
+            if (!m_overlayStats) {
+                LogError("Failed to create statistics memory-mapped file.\n");
+            }
+
+            LARGE_INTEGER frequency;
+            QueryPerformanceFrequency(&frequency);
+            m_qpcFrequency = (double)frequency.QuadPart;
+
+            m_windowGeometry = std::make_unique<WindowGeometryCache>(m_capacity);
+            m_inputInjector = std::make_unique<InputInjector>();
+
+            m_useAsyncComposition = getSetting(L"async_composition", 0);
+            if (m_useAsyncComposition) {
+                Log("Using asynchronous composition.\n");
+                m_frameArrivedEvent.create(wil::EventOptions::None);
+                m_stopCompositionEvent.create(wil::EventOptions::ManualReset);
+            }
+
+            m_stagingEvent.create(wil::EventOptions::None);
+            m_stopStagingEvent.create(wil::EventOptions::ManualReset);
+
+            m_useAdaptiveResolution = getSetting(L"adaptive_resolution", 0);
+            if (m_useAdaptiveResolution) {
+                Log("Using adaptive resolution.\n");
+            }
+
+            // In microseconds of GPU time per frame.
+            m_gpuBudget = getSetting(L"gpu_budget", 0);
+            if (m_gpuBudget) {
+                Log("Using GPU budget: %u us\n", m_gpuBudget);
+            }
+
+            m_useLateLatching = getSetting(L"late_latching", 0);
+            if (m_useLateLatching) {
+                Log("Using late latching of the cursor.\n");
+            }
+
+            m_useAtlas = getSetting(L"texture_atlas", 0);
+            if (m_useAtlas) {
+                Log("Using texture atlas for small windows.\n");
+            }
+
+            // In seconds, 0 to only take new snapshots on request.
+            m_snapshotInterval = (int64_t)(getSetting(L"snapshot_interval", 60) * m_qpcFrequency);
+
+            m_useOcclusionCulling = getSetting(L"occlusion_culling", 0);
+            if (m_useOcclusionCulling) {
+                Log("Using occlusion culling.\n");
+            }
+
+            m_useDirectCapture = getSetting(L"direct_capture", 0);
+            if (m_useDirectCapture) {
+                Log("Using direct capture for opaque windows.\n");
+            }
+
+            m_useCrossAdapterCapture = getSetting(L"cross_adapter_capture", 0);
+            if (m_useCrossAdapterCapture) {
+                Log("Capturing on the adapter driving each monitor.\n");
+            }
 
             Log("Hello!\n");
         }
 
         ~OverlayManager() {
             Log("Shutting down...\n");
+            StopCompositionThread();
+            StopStagingThread();
+            ClearSwapchainPool();
+            DestroyWindowSwapchain(m_atlas);
+            m_windowGeometry.reset();
+            m_inputInjector.reset();
             if (m_cursorSwapchain) {
                 m_dispatchTable.ovr_DestroyTextureSwapChain(m_ovrSession, m_cursorSwapchain);
             }
             if (m_compositionDevice) {
                 FlushCompositionDevice();
             }
-            if (m_overlayState) {
-                UnmapViewOfFile(m_overlayState);
+            if (m_overlayStateHeader) {
+                UnmapViewOfFile(m_overlayStateHeader);
+            }
+            if (m_overlayStats) {
+                UnmapViewOfFile(m_overlayStats);
             }
             Log("Bye!\n");
         }
 
-        void SetSubmissionSession(ovrSession session, const ovrDispatchTable& dispatchTable, ID3D11Device* device) {
+        void SetSubmissionSession(ovrSession session,
+                                  const ovrDispatchTable& dispatchTable,
+                                  const ovrDispatchTable2& dispatchTable2,
+                                  ID3D11Device* device) {
             if (!m_overlayState) {
                 return;
             }
 
             Log("Acquiring new OVR session.\n");
 
+            StopCompositionThread();
+            StopStagingThread();
+            ClearSwapchainPool();
+            DestroyWindowSwapchain(m_atlas);
+            m_atlasAllocator.reset();
+            m_atlasReadyFenceValue = 0;
+            m_isAtlasDirty = false;
             if (m_compositionDevice) {
                 FlushCompositionDevice();
             }
@@ -643,18 +2600,80 @@ void main(uint2 pos : SV_DispatchThreadID)
                 m_dispatchTable.ovr_DestroyTextureSwapChain(m_ovrSession, m_cursorSwapchain);
             }
 
+            // Keep the captures across a session change on the same adapter. Only the swapchains belong to the
+            // session. Direct captures are on the previous submission device and cannot be kept.
+            const bool reuseCompositionDevice = CanReuseCompositionDevice(device);
+            m_retainedCaptures.clear();
+            if (reuseCompositionDevice) {
+                for (uint32_t i : m_activeSlots) {
+                    auto& window = m_windows[i];
+                    if (window.captureWindow && !window.isDirectCapture) {
+                        m_retainedCaptures.push_back(
+                            {window.hwnd, window.monitor, window.captureFormat, std::move(window.captureWindow)});
+                    }
+                }
+            }
+
             m_ovrSession = session;
             m_dispatchTable = dispatchTable;
-            for (auto& window : m_windows) {
-                window.Initialize(session, dispatchTable);
+            // Only look at the optional entry points the caller knows about.
+            m_getHmdDesc = dispatchTable2.size >= offsetof(ovrDispatchTable2, ovr_GetHmdDesc) + sizeof(void*)
+                               ? dispatchTable2.ovr_GetHmdDesc
+                               : nullptr;
+            for (uint32_t i = 0; i < m_capacity; i++) {
+                m_windows[i].Initialize(session, dispatchTable);
             }
+            // All windows will be reopened.
+            m_activeSlots.clear();
+            m_openedSlots = 0;
+            m_isStateSyncPending = true;
 
             CHECK_HRCMD(device->QueryInterface(m_submissionDevice.ReleaseAndGetAddressOf()));
             ComPtr<ID3D11DeviceContext> context;
             m_submissionDevice->GetImmediateContext(context.ReleaseAndGetAddressOf());
             CHECK_HRCMD(context->QueryInterface(m_submissionContext.ReleaseAndGetAddressOf()));
 
-            InitializeCompositionResources();
+            // Cull against the field of view of both eyes combined, plus a guard band.
+            {
+                ovrFovPort fov{DefaultFovTan, DefaultFovTan, DefaultFovTan, DefaultFovTan};
+                if (m_getHmdDesc) {
+                    const ovrHmdDesc hmdDesc = m_getHmdDesc(session);
+                    fov = hmdDesc.DefaultEyeFov[ovrEye_Left];
+                    fov.UpTan = std::max(fov.UpTan, hmdDesc.DefaultEyeFov[ovrEye_Right].UpTan);
+                    fov.DownTan = std::max(fov.DownTan, hmdDesc.DefaultEyeFov[ovrEye_Right].DownTan);
+                    fov.LeftTan = std::max(fov.LeftTan, hmdDesc.DefaultEyeFov[ovrEye_Right].LeftTan);
+                    fov.RightTan = std::max(fov.RightTan, hmdDesc.DefaultEyeFov[ovrEye_Right].RightTan);
+                }
+                const auto widen = [](float tan) {
+                    // Past 90 degrees, the half-space test would flip.
+                    return std::tan(std::min(std::atan(tan) + CullingGuardBand, DirectX::XM_PIDIV2 - 0.01f));
+                };
+                m_cullingFov = {widen(fov.UpTan), widen(fov.DownTan), widen(fov.LeftTan), widen(fov.RightTan)};
+            }
+
+            // The swapchains can only be created in the background if the application's device is thread-safe.
+            m_canStageSwapchains = !(m_submissionDevice->GetCreationFlags() & D3D11_CREATE_DEVICE_SINGLETHREADED);
+            if (!m_canStageSwapchains) {
+                Log("Application device is single-threaded: creating swapchains on the render thread.\n");
+            }
+
+            // Direct captures also use the application's device from the capture worker threads.
+            m_canDirectCapture = m_useDirectCapture && m_canStageSwapchains;
+            if (m_useDirectCapture && !m_canDirectCapture) {
+                Log("Direct capture is not available with a single-threaded application device.\n");
+            }
+
+            if (reuseCompositionDevice) {
+                Log("Reusing composition device.\n");
+            } else {
+                InitializeCompositionResources();
+            }
+            InitializeSessionResources();
+
+            StartStagingThread();
+            if (m_useAsyncComposition) {
+                StartCompositionThread();
+            }
         }
 
         void Update(double ovrTime) {
@@ -662,36 +2681,132 @@ void main(uint2 pos : SV_DispatchThreadID)
                 return;
             }
 
+            if (m_useAsyncComposition && m_isCompositionThreadFailed) {
+                LogError("Falling back to synchronous composition.\n");
+                StopCompositionThread();
+                m_useAsyncComposition = false;
+            }
+
+            // With asynchronous composition, the composition thread only holds the lock while it picks up the new
+            // frames and while it publishes the results, never while it records the copies. We only hold it while we
+            // touch the state it uses: the interactions and the layout of the layers are done without it.
+            std::unique_lock lock(m_compositionMutex, std::defer_lock);
+            if (m_useAsyncComposition) {
+                lock.lock();
+            }
+
+            const int64_t startTime = getQpcTime();
+            if (m_lastUpdateTime) {
+                const double frameTime = (double)(startTime - m_lastUpdateTime);
+                m_frameTime = m_frameTime ? m_frameTime + 0.1 * (frameTime - m_frameTime) : frameTime;
+            }
+            m_lastUpdateTime = startTime;
+            CollectStagedResources();
             SortWindows();
+            if (lock.owns_lock()) {
+                lock.unlock();
+            }
+            const int64_t sortTime = getQpcTime();
             HandleInteractions(ovrTime);
+            const int64_t interactionsTime = getQpcTime();
+            if (m_useAsyncComposition) {
+                lock.lock();
+            }
             UpdateWindows();
+            if (m_gpuBudget) {
+                UpdateGpuBudget();
+            }
+            const int64_t updateTime = getQpcTime();
 
-            // Serialize composition work.
-            m_submissionFenceValue++;
-            CHECK_HRCMD(m_compositionContext->Signal(m_fenceOnCompositionDevice.Get(), m_submissionFenceValue));
-            CHECK_HRCMD(m_submissionContext->Wait(m_fenceOnSubmissionDevice.Get(), m_submissionFenceValue));
+            m_sortWindowsStats.addSample((float)((sortTime - startTime) * 1000.0 / m_qpcFrequency));
+            m_handleInteractionsStats.addSample((float)((interactionsTime - sortTime) * 1000.0 / m_qpcFrequency));
+            m_updateWindowsStats.addSample((float)((updateTime - interactionsTime) * 1000.0 / m_qpcFrequency));
+            PublishStats();
+
+            // Serialize composition work. Skip the fence entirely when no composition work was submitted.
+            if (!m_useAsyncComposition && HasDirtyWindows()) {
+                PublishWindowsContent();
+            }
+
+            // Only wait for the windows whose swapchain images are about to be committed. The submission context
+            // executes in order, so there is no need to wait again for a value we already waited for.
+            uint64_t fenceValue = m_atlasReadyFenceValue;
+            for (uint32_t windowIndex : m_sortedWindows) {
+                fenceValue = std::max(fenceValue, m_windows[windowIndex].readyFenceValue);
+            }
+            if (fenceValue > m_lastWaitedFenceValue) {
+                CHECK_HRCMD(m_submissionContext->Wait(m_fenceOnSubmissionDevice.Get(), fenceValue));
+                m_lastWaitedFenceValue = fenceValue;
+            }
 
             // Commit the state and swapchain images.
-            for (uint32_t i = 0; i < m_windows.size(); i++) {
+            GpuTimer* directGpuTimer = nullptr;
+            if (m_canDirectCapture) {
+                directGpuTimer = &BeginGpuTimer(m_submissionContext.Get(), m_directGpuTimers, m_directGpuTimerIndex);
+            }
+            for (uint32_t i : m_activeSlots) {
                 auto& window = m_windows[i];
 
-                if (!window.IsValid()) {
-                    continue;
+                SyncWindow(i);
+
+                bool isContentReady = window.readyFenceValue != 0;
+                if (window.isDirectCapture && window.isSorted && !isContentReady) {
+                    isContentReady = CopyDirectWindowContent(window, i, *directGpuTimer);
                 }
 
-                SyncWindow(i);
+                // Unchanged windows keep displaying their previously committed image.
+                if (window.swapchain.handle && isContentReady && window.isSorted) {
+                    CHECK_OVRCMD(m_dispatchTable.ovr_CommitTextureSwapChain(m_ovrSession, window.swapchain.handle));
+                    window.quad.ColorTexture = window.swapchain.handle;
+                    window.quad.Viewport = window.contentViewport;
+                    window.readyFenceValue = 0;
+                    ReleaseSwapchain(window.retiredSwapchain);
+                    if (window.atlasRect && !window.isInAtlas) {
+                        FreeAtlasRect(window);
+                    }
+                    if (window.swapchain.isStatic) {
+                        window.swapchain.isCommitted = true;
+                        if (window.isSnapshot) {
+                            ReleaseWindowCapture(window);
+                        }
+                    }
 
-                if (window.swapchain &&
-                    std::find(m_sortedWindows.cbegin(), m_sortedWindows.cend(), i) != m_sortedWindows.cend()) {
-                    CHECK_OVRCMD(m_dispatchTable.ovr_CommitTextureSwapChain(m_ovrSession, window.swapchain));
+                    // The composition thread may have held off a newer frame until this one was committed.
+                    m_wakeCompositionThread = true;
                 }
             }
+            if (directGpuTimer) {
+                m_submissionContext->End(directGpuTimer->disjoint.Get());
+                directGpuTimer->isPending = true;
+            }
+            if (m_atlasReadyFenceValue) {
+                CommitAtlas();
+            }
+
+            TrimSwapchainPool();
+
+            if (m_useAsyncComposition && m_wakeCompositionThread) {
+                SetEvent(m_frameArrivedEvent.get());
+            }
+            m_wakeCompositionThread = false;
+            if (lock.owns_lock()) {
+                lock.unlock();
+            }
+
+            for (uint32_t windowIndex : m_sortedWindows) {
+                UpdateWindowLayout(m_windows[windowIndex]);
+            }
         }
 
-        void GetLayers(std::vector<const ovrLayerHeader*>& layers) {
+        void GetLayers(double ovrTime, std::vector<const ovrLayerHeader*>& layers) {
+            if (m_useLateLatching && m_cursorPose) {
+                LateLatchCursor(ovrTime);
+            }
+
             for (uint32_t index : m_sortedWindows) {
-                if (m_windows[index].quad.ColorTexture) {
-                    layers.push_back(&m_windows[index].quad.Header);
+                const auto& window = m_windows[index];
+                if (window.quad.ColorTexture) {
+                    layers.push_back(window.IsCurved() ? &window.cylinder.Header : &window.quad.Header);
                 }
             }
 
@@ -720,6 +2835,53 @@ void main(uint2 pos : SV_DispatchThreadID)
             return m_cursorPose.has_value();
         }
 
+        // Sample the aim of the interacting hand again right before submission, and move the cursor (and the window
+        // being dragged) along. The interactions themselves were already handled with the earlier sample.
+        void LateLatchCursor(double ovrTime) {
+            const uint32_t side = m_lastSideToInteract;
+            const ovrTrackingState tracking = m_dispatchTable.ovr_GetTrackingState(m_ovrSession, ovrTime, false);
+            if (!(tracking.HandStatusFlags[side] & (ovrStatus_PositionValid | ovrStatus_OrientationValid))) {
+                return;
+            }
+
+            // Use the aim pose relative to the space the window pose refers to.
+            auto& window = m_windows[m_windowHovered];
+            OVR::Posef aimPose = tracking.HandPoses[side].ThePose;
+            if (window.placement == WindowPlacement::HeadLocked) {
+                aimPose = aimPose * OVR::Posef(tracking.HeadPose.ThePose).Inverted();
+            }
+
+            // Keep the earlier cursor if the aim slipped off the window in the meantime.
+            ovrPosef hitPose;
+            const bool isHit = window.IsCurved()
+                                   ? geom::hitTest(aimPose, window.cylinderGeometry, window.hitPlaneSize, hitPose)
+                                   : geom::hitTest(aimPose, window.quad.QuadPoseCenter, window.hitPlaneSize, hitPose);
+            if (!isHit) {
+                return;
+            }
+
+            if (m_isDraggingWindow) {
+                // Carry the window along the cursor, within the same limits as when dragging.
+                OVR::Vector3f delta = OVR::Vector3f(hitPose.Position) - OVR::Vector3f(m_cursorPose.value().Position);
+                delta.x = std::clamp(delta.x, -0.02f, 0.02f);
+                delta.y = std::clamp(delta.y, -0.02f, 0.02f);
+                delta.z = std::clamp(delta.z, -0.01f, 0.01f);
+
+                const OVR::Vector3f newPosition = OVR::Vector3f(window.quad.QuadPoseCenter.Position) + delta;
+                if ((newPosition - OVR::Vector3f(tracking.HeadPose.ThePose.Position)).Length() >= MaxDistance) {
+                    return;
+                }
+                window.quad.QuadPoseCenter.Position = newPosition;
+                hitPose.Position = OVR::Vector3f(m_cursorPose.value().Position) + delta;
+                if (window.IsCurved()) {
+                    UpdateWindowCylinder(window);
+                }
+            }
+
+            m_cursorPose = OVR::Posef::Pose(
+                window.IsCurved() ? hitPose.Orientation : window.quad.QuadPoseCenter.Orientation, hitPose.Position);
+        }
+
       private:
         void InitializeCompositionResources() {
             // Create our own device on the same adapter.
@@ -727,6 +2889,12 @@ void main(uint2 pos : SV_DispatchThreadID)
             CHECK_HRCMD(m_submissionDevice->QueryInterface(dxgiDevice.ReleaseAndGetAddressOf()));
             ComPtr<IDXGIAdapter> dxgiAdapter;
             CHECK_HRCMD(dxgiDevice->GetAdapter(dxgiAdapter.ReleaseAndGetAddressOf()));
+            {
+                DXGI_ADAPTER_DESC desc;
+                CHECK_HRCMD(dxgiAdapter->GetDesc(&desc));
+                m_compositionAdapterLuid = desc.AdapterLuid;
+            }
+            m_owningAdapters.clear();
 
             ComPtr<ID3D11Device> device;
             ComPtr<ID3D11DeviceContext> context;
@@ -749,51 +2917,62 @@ void main(uint2 pos : SV_DispatchThreadID)
             CHECK_HRCMD(device->QueryInterface(m_compositionDevice.ReleaseAndGetAddressOf()));
             CHECK_HRCMD(context->QueryInterface(m_compositionContext.ReleaseAndGetAddressOf()));
 
+            // The desktop is composed in BGRA, but we can only capture in this format if the transparency shader can
+            // write it.
+            {
+                D3D11_FEATURE_DATA_FORMAT_SUPPORT2 support{DXGI_FORMAT_B8G8R8A8_UNORM};
+                m_canWriteBgra =
+                    SUCCEEDED(m_compositionDevice->CheckFeatureSupport(
+                        D3D11_FEATURE_FORMAT_SUPPORT2, &support, sizeof(support))) &&
+                    (support.OutFormatSupport2 & D3D11_FORMAT_SUPPORT2_UAV_TYPED_STORE);
+                if (!m_canWriteBgra) {
+                    Log("Device cannot write BGRA: capturing in RGBA.\n");
+                }
+            }
+
+            // The desktop is composed in FP16 on HDR outputs. Look at the outputs of all adapters, since the windows on
+            // the outputs of another adapter are captured too.
+            m_hdrOutputs.clear();
+            {
+                ComPtr<IDXGIFactory1> factory;
+                CHECK_HRCMD(CreateDXGIFactory1(IID_PPV_ARGS(factory.ReleaseAndGetAddressOf())));
+                ComPtr<IDXGIAdapter1> adapter;
+                for (UINT i = 0; factory->EnumAdapters1(i, adapter.ReleaseAndGetAddressOf()) == S_OK; i++) {
+                    ComPtr<IDXGIOutput> output;
+                    for (UINT j = 0; adapter->EnumOutputs(j, output.ReleaseAndGetAddressOf()) == S_OK; j++) {
+                        ComPtr<IDXGIOutput6> output6;
+                        DXGI_OUTPUT_DESC1 desc;
+                        if (SUCCEEDED(output.As(&output6)) && SUCCEEDED(output6->GetDesc1(&desc)) &&
+                            desc.ColorSpace == DXGI_COLOR_SPACE_RGB_FULL_G2084_NONE_P2020) {
+                            const float scale = getSdrWhiteScale(desc.Monitor);
+                            Log("HDR output: %ls (SDR white scale: %.2f)\n", desc.DeviceName, scale);
+                            m_hdrOutputs.push_back(std::make_pair(desc.Monitor, scale));
+                        }
+                    }
+                }
+            }
+
             // Create serialization fence.
             CHECK_HRCMD(m_compositionDevice->CreateFence(
                 0, D3D11_FENCE_FLAG_SHARED, IID_PPV_ARGS(m_fenceOnCompositionDevice.ReleaseAndGetAddressOf())));
-            wil::unique_handle fenceHandle;
-            CHECK_HRCMD(
-                m_fenceOnCompositionDevice->CreateSharedHandle(nullptr, GENERIC_ALL, nullptr, fenceHandle.put()));
-            CHECK_HRCMD(m_submissionDevice->OpenSharedFence(
-                fenceHandle.get(), IID_PPV_ARGS(m_fenceOnSubmissionDevice.ReleaseAndGetAddressOf())));
-
-            const auto compileShader =
-                [&](const std::string_view& code, const std::string_view& entry, ComPtr<ID3DBlob>& shaderBytes) {
-                    ComPtr<ID3DBlob> errMsgs;
-                    DWORD flags = D3DCOMPILE_ENABLE_STRICTNESS | D3DCOMPILE_WARNINGS_ARE_ERRORS;
-#ifdef _DEBUG
-                    flags |= D3DCOMPILE_SKIP_OPTIMIZATION | D3DCOMPILE_DEBUG;
-#else
-                    flags |= D3DCOMPILE_OPTIMIZATION_LEVEL3;
-#endif
 
-                    const HRESULT hr = D3DCompile(code.data(),
-                                                  code.size(),
-                                                  nullptr,
-                                                  nullptr,
-                                                  nullptr,
-                                                  entry.data(),
-                                                  "cs_5_0",
-                                                  flags,
-                                                  0,
-                                                  shaderBytes.ReleaseAndGetAddressOf(),
-                                                  errMsgs.ReleaseAndGetAddressOf());
-                    if (FAILED(hr)) {
-                        std::string errMsg((const char*)errMsgs->GetBufferPointer(), errMsgs->GetBufferSize());
-                        Log("D3DCompile failed %X: %s\n", hr, errMsg.c_str());
-                        CHECK_HRCMD(hr);
-                    }
-                };
+            CreateGpuTimers(m_compositionDevice.Get(), m_gpuTimers);
 
             // Create the resources for the transparency shader
             {
-                ComPtr<ID3DBlob> shaderBytes;
-                compileShader(TransparencyShaderHlsl, "main", shaderBytes);
-                CHECK_HRCMD(m_compositionDevice->CreateComputeShader(shaderBytes->GetBufferPointer(),
-                                                                     shaderBytes->GetBufferSize(),
+                CHECK_HRCMD(m_compositionDevice->CreateComputeShader(g_TransparencyShader,
+                                                                     sizeof(g_TransparencyShader),
                                                                      nullptr,
                                                                      m_transparencyShader.ReleaseAndGetAddressOf()));
+                CHECK_HRCMD(
+                    m_compositionDevice->CreateComputeShader(g_TransparencyShaderColorKey,
+                                                             sizeof(g_TransparencyShaderColorKey),
+                                                             nullptr,
+                                                             m_colorKeyTransparencyShader.ReleaseAndGetAddressOf()));
+                CHECK_HRCMD(m_compositionDevice->CreateComputeShader(g_TransparencyShaderDownscale,
+                                                                     sizeof(g_TransparencyShaderDownscale),
+                                                                     nullptr,
+                                                                     m_downscaleShader.ReleaseAndGetAddressOf()));
 
                 D3D11_BUFFER_DESC desc{};
                 desc.ByteWidth = sizeof(TransparencyShaderConstants);
@@ -803,6 +2982,24 @@ void main(uint2 pos : SV_DispatchThreadID)
                 CHECK_HRCMD(m_compositionDevice->CreateBuffer(
                     &desc, nullptr, m_transparencyConstants.ReleaseAndGetAddressOf()));
             }
+        }
+
+        // Create the resources bound to the OVR session or to the submission device. Called after
+        // InitializeCompositionResources() or when reusing the composition device for a new session.
+        void InitializeSessionResources() {
+            wil::unique_handle fenceHandle;
+            CHECK_HRCMD(
+                m_fenceOnCompositionDevice->CreateSharedHandle(nullptr, GENERIC_ALL, nullptr, fenceHandle.put()));
+            CHECK_HRCMD(m_submissionDevice->OpenSharedFence(
+                fenceHandle.get(), IID_PPV_ARGS(m_fenceOnSubmissionDevice.ReleaseAndGetAddressOf())));
+
+            // The copies for direct captures are timed on the submission device.
+            if (m_canDirectCapture) {
+                CreateGpuTimers(m_submissionDevice.Get(), m_directGpuTimers);
+            }
+            for (auto& stats : m_gpuTimeStats) {
+                stats.reset();
+            }
 
             // Create cursor graphics.
             {
@@ -852,6 +3049,53 @@ void main(uint2 pos : SV_DispatchThreadID)
                 m_cursorQuad.QuadSize = {CursorSize, CursorSize};
                 m_cursorQuad.Viewport.Size = {swapchainDesc.Width, swapchainDesc.Height};
             }
+
+            // The atlas is always written through the transparency shaders, so both the BGRA and RGBA captures can go
+            // into it. The HDR captures cannot: they hold linear values, and the atlas images are sRGB.
+            if (m_useAtlas) {
+                D3D11_TEXTURE2D_DESC atlasDesc{};
+                atlasDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+                atlasDesc.Width = AtlasSize.w;
+                atlasDesc.Height = AtlasSize.h;
+                m_atlas = CreateWindowSwapchain(atlasDesc, false);
+                m_atlasAllocator = std::make_unique<AtlasAllocator>(AtlasSize);
+            }
+        }
+
+        void CreateGpuTimers(ID3D11Device* device, std::array<GpuTimer, GpuTimerLatency>& timers) {
+            for (auto& timer : timers) {
+                D3D11_QUERY_DESC desc{};
+                desc.Query = D3D11_QUERY_TIMESTAMP_DISJOINT;
+                CHECK_HRCMD(device->CreateQuery(&desc, timer.disjoint.ReleaseAndGetAddressOf()));
+                desc.Query = D3D11_QUERY_TIMESTAMP;
+                timer.start.resize(m_capacity);
+                timer.end.resize(m_capacity);
+                for (uint32_t i = 0; i < m_capacity; i++) {
+                    CHECK_HRCMD(device->CreateQuery(&desc, timer.start[i].ReleaseAndGetAddressOf()));
+                    CHECK_HRCMD(device->CreateQuery(&desc, timer.end[i].ReleaseAndGetAddressOf()));
+                }
+                timer.usedSlots.clear();
+                timer.usedSlots.reserve(m_capacity);
+                timer.isPending = false;
+            }
+        }
+
+        // Whether the composition device (and the captures on it) can be kept for a new submission device.
+        bool CanReuseCompositionDevice(ID3D11Device* submissionDevice) const {
+            if (!m_compositionDevice || m_compositionDevice->GetDeviceRemovedReason() != S_OK) {
+                return false;
+            }
+
+            ComPtr<IDXGIDevice> dxgiDevice;
+            ComPtr<IDXGIAdapter> dxgiAdapter;
+            DXGI_ADAPTER_DESC desc;
+            if (FAILED(submissionDevice->QueryInterface(dxgiDevice.ReleaseAndGetAddressOf())) ||
+                FAILED(dxgiDevice->GetAdapter(dxgiAdapter.ReleaseAndGetAddressOf())) ||
+                FAILED(dxgiAdapter->GetDesc(&desc))) {
+                return false;
+            }
+            return desc.AdapterLuid.LowPart == m_compositionAdapterLuid.LowPart &&
+                   desc.AdapterLuid.HighPart == m_compositionAdapterLuid.HighPart;
         }
 
         // Flush all commands on the composition device (prepare for destruction).
@@ -864,23 +3108,69 @@ void main(uint2 pos : SV_DispatchThreadID)
             WaitForSingleObject(eventHandle.get(), INFINITE);
         }
 
+        // Open and close windows to match the slots occupied in the memory mapped file.
+        void UpdateOpenedWindows() {
+            // Detect window added/removed. The ShellApp tells us which slots are occupied, so that we never look at
+            // the empty ones. A slot may also have been released and reassigned in between two frames.
+            const uint64_t activeSlots =
+                m_overlayStateHeader->activeSlots &
+                (m_capacity < shared::MaxOverlayCount ? (1ull << m_capacity) - 1 : ~0ull);
+            uint64_t staleSlots = activeSlots ^ m_openedSlots;
+            for (uint32_t i : m_activeSlots) {
+                if (m_overlayState[i].generation != m_windows[i].generation) {
+                    staleSlots |= 1ull << i;
+                }
+            }
+            uint64_t pendingSlots = 0;
+            while (staleSlots) {
+                unsigned long i;
+                _BitScanForward64(&i, staleSlots);
+                staleSlots &= staleSlots - 1;
+
+                if (m_windows[i].IsValid()) {
+                    CloseWindow(i);
+                }
+                if ((activeSlots & (1ull << i)) && !OpenWindow(i)) {
+                    pendingSlots |= 1ull << i;
+                }
+            }
+            m_openedSlots = activeSlots & ~pendingSlots;
+            if (pendingSlots) {
+                m_isStateSyncPending = true;
+            } else {
+                // The captures from the previous session that were not claimed by now belong to closed windows.
+                m_retainedCaptures.clear();
+            }
+        }
+
         // Determine visible windows and drawing order.
         void SortWindows() {
-            std::vector<std::pair<float, uint32_t>> distances;
-            for (uint32_t i = 0; i < m_windows.size(); i++) {
+            // Only look at the slots when the ShellApp made changes.
+            const uint32_t changeCount =
+                ReadAcquire(reinterpret_cast<const volatile LONG*>(&m_overlayStateHeader->changeCount));
+            m_isStateChanged = changeCount != m_lastChangeCount || m_isStateSyncPending;
+            m_lastChangeCount = changeCount;
+            m_isStateSyncPending = false;
+            if (m_isStateChanged) {
+                UpdateOpenedWindows();
+            }
+
+            const OVR::Posef viewFromWorld = m_lastHeadPose.Inverted();
+            const int64_t now = getQpcTime();
+            auto& distances = m_sortedWindowsDistances;
+            distances.clear();
+            for (uint32_t i : m_activeSlots) {
                 auto& window = m_windows[i];
+                window.isSorted = false;
 
-                // Detect window added/removed.
-                if (!window.IsValid()) {
-                    if (!m_overlayState[i].handle) {
-                        continue;
-                    }
-                    OpenWindow(i);
-                } else {
-                    if (!m_overlayState[i].handle) {
-                        CloseWindow(i);
-                        continue;
-                    }
+                UpdateWindowSnapshot(window, i, now);
+                UpdateWindowCaptureRetry(window, i, now);
+
+                // The capture is still being created. Snapshots remain displayed without a capture.
+                if (window.captureWindow) {
+                    window.captureSize = window.captureWindow->getSize();
+                } else if (!window.swapchain.isCommitted) {
+                    continue;
                 }
 
                 // User made the window invisible.
@@ -888,10 +3178,32 @@ void main(uint2 pos : SV_DispatchThreadID)
                     continue;
                 }
 
-                // TODO: Cull windows completely out of the view.
+                // Windows completely out of the view are not updated nor submitted. The quad size is only known once
+                // the window was laid out.
+                window.quadPoseInView = window.placement == WindowPlacement::HeadLocked
+                                            ? window.quad.QuadPoseCenter
+                                            : viewFromWorld * OVR::Posef(window.quad.QuadPoseCenter);
+                if (window.quad.QuadSize.x > 0.f &&
+                    geom::isQuadOutsideFrustum(window.quadPoseInView, GetCullingSize(window), m_cullingFov)) {
+                    continue;
+                }
+
                 const OVR::Vector3f vector =
                     OVR::Vector3f(window.quad.QuadPoseCenter.Position) - m_lastHeadPose.Translation;
                 distances.push_back(std::make_pair(vector.Length(), i));
+
+                if (m_useAdaptiveResolution) {
+                    // Head-locked windows are positioned relative to the head already.
+                    const float distance = window.placement == WindowPlacement::HeadLocked
+                                               ? OVR::Vector3f(window.quad.QuadPoseCenter.Position).Length()
+                                               : vector.Length();
+                    UpdateWindowDownscale(window, i, distance);
+                }
+                UpdateWindowOutput(window, i);
+                UpdateWindowCapture(window, i);
+                if (m_atlas.handle) {
+                    UpdateWindowAtlas(window);
+                }
             }
 
             // Sort from back to front.
@@ -901,7 +3213,52 @@ void main(uint2 pos : SV_DispatchThreadID)
             m_sortedWindows.clear();
             for (const auto& entry : distances) {
                 m_sortedWindows.push_back(entry.second);
+                m_windows[entry.second].isSorted = true;
+            }
+
+            if (m_useOcclusionCulling) {
+                CullOccludedWindows();
+            }
+        }
+
+        // A curved window is culled as the flat quad that covers it when seen from the axis of the cylinder.
+        static ovrVector2f GetCullingSize(const Window& window) {
+            return window.IsCurved() && window.cylinderGeometry.angle > 0.f
+                       ? geom::getBoundingQuadSize(window.cylinderGeometry)
+                       : window.quad.QuadSize;
+        }
+
+        // Whether a window is guaranteed to hide what is behind it.
+        bool IsOccluder(const Window& window) const {
+            return window.quad.ColorTexture && window.quad.QuadSize.x > 0.f && !window.isMinimized &&
+                   !window.IsCurved() && !window.isColorKeyed && window.opacity >= 1.f - OpacityThreshold;
+        }
+
+        // Remove the windows entirely hidden behind a nearer opaque window from the sorted windows.
+        void CullOccludedWindows() {
+            // Go from front to back, so that only windows that remain visible are used as occluders.
+            for (size_t i = m_sortedWindows.size(); i-- > 0;) {
+                auto& window = m_windows[m_sortedWindows[i]];
+                if (window.quad.QuadSize.x <= 0.f || window.IsCurved()) {
+                    continue;
+                }
+                for (size_t j = i + 1; j < m_sortedWindows.size(); j++) {
+                    const auto& occluder = m_windows[m_sortedWindows[j]];
+                    if (occluder.isSorted && IsOccluder(occluder) &&
+                        geom::isQuadOccluded(window.quadPoseInView,
+                                             window.quad.QuadSize,
+                                             occluder.quadPoseInView,
+                                             occluder.quad.QuadSize,
+                                             EyeOffset)) {
+                        window.isSorted = false;
+                        break;
+                    }
+                }
             }
+            m_sortedWindows.erase(std::remove_if(m_sortedWindows.begin(),
+                                                 m_sortedWindows.end(),
+                                                 [&](uint32_t i) { return !m_windows[i].isSorted; }),
+                                  m_sortedWindows.end());
         }
 
         // Handle interactions with the windows.
@@ -910,6 +3267,10 @@ void main(uint2 pos : SV_DispatchThreadID)
             ovrTrackingState tracking = m_dispatchTable.ovr_GetTrackingState(m_ovrSession, ovrTime, false);
             const OVR::Posef headPose = tracking.HeadPose.ThePose;
 
+            // Read the buttons state, once for all the interactions this frame.
+            m_inputState = {};
+            m_dispatchTable.ovr_GetInputState(m_ovrSession, ovrControllerType_Touch, &m_inputState);
+
             // Get the aim from each hand.
             std::optional<OVR::Posef> aimPoseInLocalSpace[2];
             std::optional<OVR::Posef> aimPoseInViewSpace[2];
@@ -922,6 +3283,21 @@ void main(uint2 pos : SV_DispatchThreadID)
                 aimPoseInViewSpace[side] = aimPoseInLocalSpace[side].value() * headPose.Inverted();
             }
 
+            // Test the aim of each hand against all the flat windows at once, in both spaces the windows may be
+            // placed in. Only the candidates are then tested precisely, to obtain the hit pose.
+            m_hitPlanes.clear();
+            for (uint32_t windowIndex : m_sortedWindows) {
+                auto& window = m_windows[windowIndex];
+                UpdateWindowHitPlane(window);
+                m_hitPlanes.push_back(window.hitPlane);
+            }
+            for (uint32_t side = 0; side < 2; side++) {
+                if (aimPoseInLocalSpace[side]) {
+                    m_hitPlanes.hitTest(aimPoseInLocalSpace[side].value(), m_hitCandidates[side][0]);
+                    m_hitPlanes.hitTest(aimPoseInViewSpace[side].value(), m_hitCandidates[side][1]);
+                }
+            }
+
             // Perform hittesting to find a focused window. We perform the test from back (closest window) to front
             // (fartherest window).
             m_lastCursorPosition = m_cursorPose ? m_cursorPose.value().Position : ovrVector3f{0, 0, 0};
@@ -929,49 +3305,42 @@ void main(uint2 pos : SV_DispatchThreadID)
             decltype(m_sortedWindows)::reverse_iterator it;
             bool isHoveringOnWindow = false;
             for (it = m_sortedWindows.rbegin(); !m_cursorPose && it != m_sortedWindows.rend(); ++it) {
-                Window& window = m_windows.at(*it);
+                Window& window = m_windows[*it];
+                const size_t sortedIndex = std::distance(it, m_sortedWindows.rend()) - 1;
 
                 const bool wasHoveringOnWindow = isHoveringOnWindow;
                 if (!isHoveringOnWindow) {
-                    // We will draw the cursor if and only if the controller aim hits close to the overlay (up
-                    // to 50px on each corner) outside.
-                    const int32_t margin = 50;
-                    ovrSizei sizeInPixels = window.captureWindow->getSize();
-                    const ovrVector2f& windowSize = window.quad.QuadSize;
-                    const ovrVector2f pixelsPerMeter = {sizeInPixels.w / windowSize.x, sizeInPixels.h / windowSize.y};
-
                     // When both hands are focusing on a window, always "continue" interacting with the same hand as
                     // previously.
                     uint32_t side = m_lastSideToInteract;
                     bool hovering = false;
                     for (uint32_t i = 0; i < 2; i++) {
-                        if (aimPoseInLocalSpace[side]) {
+                        const bool isHeadLocked = window.placement == WindowPlacement::HeadLocked;
+                        if (aimPoseInLocalSpace[side] &&
+                            (window.IsCurved() || m_hitCandidates[side][isHeadLocked][sortedIndex])) {
                             // Use the aim pose relative to the space the window pose refers to.
-                            OVR::Posef aimPose;
-                            switch (window.placement) {
-                            case WindowPlacement::WorldLocked:
-                                aimPose = aimPoseInLocalSpace[side].value();
-                                break;
-                            case WindowPlacement::HeadLocked:
-                                aimPose = aimPoseInViewSpace[side].value();
-                                break;
-                            };
+                            const OVR::Posef aimPose =
+                                isHeadLocked ? aimPoseInViewSpace[side].value() : aimPoseInLocalSpace[side].value();
 
                             ovrPosef hitPose;
-                            if (geom::hitTest(aimPose,
-                                              window.quad.QuadPoseCenter,
-                                              {(sizeInPixels.w + margin * 2) / pixelsPerMeter.x,
-                                               (sizeInPixels.h + margin * 2) / pixelsPerMeter.y},
-                                              hitPose)) {
+                            const ovrVector2f& hitSize = window.hitPlaneSize;
+                            const bool isHit =
+                                window.IsCurved()
+                                    ? geom::hitTest(aimPose, window.cylinderGeometry, hitSize, hitPose)
+                                    : geom::hitTest(aimPose, window.quad.QuadPoseCenter, hitSize, hitPose);
+                            if (isHit) {
                                 // Handle interactions for the focused window.
                                 const OVR::Posef controllerPoses[2] = {
                                     aimPoseInLocalSpace[0].value_or(OVR::Posef::Identity()),
                                     aimPoseInLocalSpace[1].value_or(OVR::Posef::Identity())};
-                                HandleWindowInteractions(window, side, headPose, controllerPoses, hitPose);
+                                HandleWindowInteractions(window, *it, side, headPose, controllerPoses, hitPose);
 
-                                m_cursorPose =
-                                    OVR::Posef::Pose(window.quad.QuadPoseCenter.Orientation, hitPose.Position);
+                                // On a cylinder, the cursor follows the curve.
+                                m_cursorPose = OVR::Posef::Pose(
+                                    window.IsCurved() ? hitPose.Orientation : window.quad.QuadPoseCenter.Orientation,
+                                    hitPose.Position);
                                 m_lastSideToInteract = side;
+                                m_windowHovered = *it;
                                 isHoveringOnWindow = true;
                                 break;
                             }
@@ -993,14 +3362,31 @@ void main(uint2 pos : SV_DispatchThreadID)
             m_lastHeadPose = headPose;
         }
 
+        // We will draw the cursor if and only if the controller aim hits close to the overlay (up to 50px on each
+        // corner) outside.
+        void UpdateWindowHitPlane(Window& window) {
+            const int32_t margin = 50;
+            const ovrSizei sizeInPixels = window.captureSize;
+            const ovrVector2f& windowSize = window.quad.QuadSize;
+            const ovrVector2f pixelsPerMeter = {sizeInPixels.w / windowSize.x, sizeInPixels.h / windowSize.y};
+            const ovrVector2f hitSize = {(sizeInPixels.w + margin * 2) / pixelsPerMeter.x,
+                                         (sizeInPixels.h + margin * 2) / pixelsPerMeter.y};
+
+            if (memcmp(&window.hitPlanePose, &window.quad.QuadPoseCenter, sizeof(window.hitPlanePose)) ||
+                memcmp(&window.hitPlaneSize, &hitSize, sizeof(hitSize))) {
+                window.hitPlanePose = window.quad.QuadPoseCenter;
+                window.hitPlaneSize = hitSize;
+                window.hitPlane = geom::getHitPlane(window.hitPlanePose, window.hitPlaneSize);
+            }
+        }
+
         void HandleWindowInteractions(Window& window,
+                                      uint32_t slot,
                                       uint32_t side,
                                       const OVR::Posef& headPose,
                                       const OVR::Posef* controllerPoses,
                                       const OVR::Posef& hitPose) {
-            // Read the buttons state.
-            ovrInputState input{};
-            m_dispatchTable.ovr_GetInputState(m_ovrSession, ovrControllerType_Touch, &input);
+            const ovrInputState& input = m_inputState;
 
             const bool wasThumbstickPressed = m_isThumbstickPressed;
             m_isThumbstickPressed = input.Buttons & (!side ? ovrButton_LThumb : ovrButton_RThumb);
@@ -1053,295 +3439,1467 @@ void main(uint2 pos : SV_DispatchThreadID)
                                 const OVR::Vector3f newPosition =
                                     OVR::Vector3f(window.quad.QuadPoseCenter.Position) + delta;
 
-                                // Avoid sending a window too far from the camera.
-                                if ((newPosition - headPose.Translation).Length() < MaxDistance) {
-                                    window.quad.QuadPoseCenter.Position = newPosition;
+                                // Avoid sending a window too far from the camera.
+                                if ((newPosition - headPose.Translation).Length() < MaxDistance) {
+                                    window.quad.QuadPoseCenter.Position = newPosition;
+                                }
+                            }
+                            m_isDraggingWindow = true;
+                        } else {
+                            // Reorient the window with the joystick.
+                            const ovrVector2f& thumbstick = input.Thumbstick[side];
+                            float yaw, pitch, roll;
+                            OVR::Quatf(window.quad.QuadPoseCenter.Orientation).GetYawPitchRoll(&yaw, &pitch, &roll);
+                            // TODO: Need temporal component - frame rate isn't stable.
+                            yaw += thumbstick.x * (float)MATH_DOUBLE_TWOPI / 360;
+                            pitch += -thumbstick.y * (float)MATH_DOUBLE_TWOPI / 360;
+                            window.quad.QuadPoseCenter.Orientation = geom::RotationRollPitchYaw({pitch, yaw, 0});
+                        }
+                        geom::alignToGravity(window.quad.QuadPoseCenter);
+                    } else {
+                        // Two handed grab is used to resize the overlay.
+                        if (isResizingWindow) {
+                            const float lastLength =
+                                (m_lastControllerPoses[0].Translation - m_lastControllerPoses[1].Translation).Length();
+                            const float currentLength =
+                                (controllerPoses[0].Translation - controllerPoses[1].Translation).Length();
+                            const float delta = currentLength - lastLength;
+
+                            window.scale += delta * ScaleMultiplier;
+                        }
+                        m_isResizingWindow = true;
+                    }
+                }
+
+                // No further interactions to be handled this frame.
+                return;
+            }
+
+            // Handle mouse interactions inside the window.
+            const bool isInteractable = !window.isMinimized && window.isInteractable;
+            if (isInteractable) {
+                // Relocate our hit to be relative to the top-left corner of the window.
+                const ovrSizei sizeInPixels = window.captureSize;
+                const POINT cursorPosition =
+                    window.IsCurved()
+                        ? geom::getUVCoordinates(hitPose.Translation, window.cylinderGeometry, sizeInPixels)
+                        : geom::getUVCoordinates(
+                              hitPose.Translation, window.quad.QuadPoseCenter, window.quad.QuadSize, sizeInPixels);
+
+                // Check the window boundaries (remember: we offered a little margin when rendering the cursor).
+                if (cursorPosition.x > 0 && cursorPosition.x < sizeInPixels.w && cursorPosition.y > 0 &&
+                    cursorPosition.y < sizeInPixels.h) {
+                    const auto setCursorPos = [&]() {
+                        // Update the cursor position.
+                        // TODO: Why are coordinates off!?
+                        const WindowGeometryCache::Geometry geometry = m_windowGeometry->get(slot);
+                        POINT clickPosition = cursorPosition;
+                        clickPosition.x += geometry.origin.x;
+                        clickPosition.y += geometry.origin.y;
+                        m_inputInjector->setCursorPos(clickPosition);
+                    };
+
+                    // Continuously update cursor position once an overlay has focus.
+                    if (window.hasFocus) {
+                        setCursorPos();
+                    }
+
+                    // Simulate mouse button presses.
+                    const bool newDownEvent = (m_isPrimaryPressed && !wasPrimaryPressed) ||
+                                              (m_isSecondaryPressed && !wasSecondaryPressed) ||
+                                              (m_isThumbstickPressed && !wasThumbstickPressed);
+                    if (newDownEvent) {
+                        // Make sure the window can receive clicks.
+                        if (window.hwnd) {
+                            m_inputInjector->setForegroundWindow(window.hwnd);
+                        }
+                        if (!window.hasFocus) {
+                            // Move the cursor to the destination window.
+                            setCursorPos();
+                        }
+                        window.hasFocus = true;
+
+                        m_inputInjector->sendMouseInput(m_isPrimaryPressed     ? MOUSEEVENTF_LEFTDOWN
+                                                        : m_isSecondaryPressed ? MOUSEEVENTF_RIGHTDOWN
+                                                                               : MOUSEEVENTF_MIDDLEDOWN);
+
+                        // No further interactions to be handled this frame.
+                        return;
+                    }
+
+                    const bool newUpEvent = (!m_isPrimaryPressed && wasPrimaryPressed) ||
+                                            (!m_isSecondaryPressed && wasSecondaryPressed) ||
+                                            (!m_isThumbstickPressed && wasThumbstickPressed);
+                    if (newUpEvent) {
+                        m_inputInjector->sendMouseInput(wasPrimaryPressed     ? MOUSEEVENTF_LEFTUP
+                                                        : wasSecondaryPressed ? MOUSEEVENTF_RIGHTUP
+                                                                              : MOUSEEVENTF_MIDDLEUP);
+
+                        // No further interactions to be handled this frame.
+                        return;
+                    }
+
+                    // Simulate wheel.
+                    if (std::abs(input.Thumbstick[side].y) > 0.f) {
+                        m_inputInjector->sendMouseInput(
+                            MOUSEEVENTF_WHEEL, (DWORD)(input.Thumbstick[side].y * WHEEL_DELTA * WheelMultiplier));
+                    }
+                }
+            }
+        }
+
+        // Refresh the content of all windows.
+        void UpdateWindows() {
+            // Otherwise the composition thread does the copies.
+            if (!m_useAsyncComposition) {
+                UpdateWindowsContent();
+            }
+        }
+
+        // Poll the captures and copy the new content into the swapchain images.
+        void UpdateWindowsContent() {
+            RecordWindowsContent(PrepareWindowsContent());
+            m_composingSwapchains.clear();
+        }
+
+        // Poll the captures and queue the copies of the new content into the swapchain images. With asynchronous
+        // composition, this is done while holding the composition lock.
+        GpuTimer& PrepareWindowsContent() {
+            GpuTimer& gpuTimer = BeginGpuTimer(m_compositionContext.Get(), m_gpuTimers, m_gpuTimerIndex);
+            const int64_t now = getQpcTime();
+
+            for (auto& windowIndex : m_sortedWindows) {
+                auto& window = m_windows[windowIndex];
+
+                // The previous image has not been committed yet. Direct captures are handled on the render thread.
+                if (!window.captureWindow || window.readyFenceValue || window.hasSwapchainRequest ||
+                    window.isDirectCapture || window.isInAtlas) {
+                    continue;
+                }
+
+                // Leave the frames in the frame pool until the window is due.
+                if (!IsWindowUpdateDue(window, now)) {
+                    continue;
+                }
+
+                ID3D11Texture2D* windowSurface = window.captureWindow->getSurface();
+                if (!windowSurface) {
+                    continue;
+                }
+
+                // The window was resized.
+                const ovrSizei contentSize = window.captureWindow->getContentSize();
+                if (contentSize.w != window.lastContentSize.w || contentSize.h != window.lastContentSize.h) {
+                    m_windowGeometry->refresh(windowIndex);
+                    window.lastContentSize = contentSize;
+                }
+
+                D3D11_TEXTURE2D_DESC windowSurfaceDesc;
+                windowSurface->GetDesc(&windowSurfaceDesc);
+                if (!PrepareWindowSwapchain(window, windowIndex, windowSurfaceDesc)) {
+                    continue;
+                }
+
+                // Only copy when a new frame was captured or the opacity changed.
+                const uint64_t frameGeneration = window.captureWindow->getFrameGeneration();
+                if (frameGeneration != window.lastFrameGeneration || window.opacity != window.lastOpacity) {
+                    CopyWindowContent(window, windowIndex, windowSurface, windowSurfaceDesc);
+                    gpuTimer.usedSlots.push_back(windowIndex);
+                    window.lastFrameGeneration = frameGeneration;
+                    window.lastOpacity = window.opacity;
+                    window.isDirty = true;
+                    window.dirtySwapchain = window.swapchain.handle;
+                    m_composingSwapchains.push_back(window.swapchain.handle);
+                    ScheduleWindowUpdate(window, now);
+                }
+            }
+
+            if (m_atlas.handle && !m_atlasReadyFenceValue) {
+                UpdateAtlasContent(gpuTimer, now);
+            }
+
+            return gpuTimer;
+        }
+
+        // Record the queued copies. This only touches the composition context and the queued copies, so with
+        // asynchronous composition, it is done without holding the composition lock.
+        void RecordWindowsContent(GpuTimer& gpuTimer) {
+            for (const auto& copy : m_queuedCopies) {
+                m_compositionContext->End(gpuTimer.start[copy.slot].Get());
+                RecordCopy(copy);
+                m_compositionContext->End(gpuTimer.end[copy.slot].Get());
+            }
+            m_queuedCopies.clear();
+
+            m_compositionContext->End(gpuTimer.disjoint.Get());
+            gpuTimer.isPending = true;
+        }
+
+        // Copy the new content of the windows in the atlas. The windows share the current atlas image, so when any
+        // of them changed, the image is brought up-to-date for all of them.
+        void UpdateAtlasContent(GpuTimer& gpuTimer, int64_t now) {
+            int imageIndex = 0;
+            CHECK_OVRCMD(
+                m_dispatchTable.ovr_GetTextureSwapChainCurrentIndex(m_ovrSession, m_atlas.handle, &imageIndex));
+
+            bool hasChanges = false;
+            for (uint32_t windowIndex : m_sortedWindows) {
+                auto& window = m_windows[windowIndex];
+                if (!window.isInAtlas || !window.captureWindow) {
+                    continue;
+                }
+
+                // Leave the frames in the frame pool until the window is due.
+                if (IsWindowUpdateDue(window, now) && window.captureWindow->getSurface()) {
+                    const ovrSizei contentSize = window.captureWindow->getContentSize();
+                    if (contentSize.w != window.lastContentSize.w || contentSize.h != window.lastContentSize.h) {
+                        m_windowGeometry->refresh(windowIndex);
+                        window.lastContentSize = contentSize;
+                    }
+                }
+                hasChanges = hasChanges ||
+                             window.captureWindow->getFrameGeneration() != window.lastFrameGeneration ||
+                             window.opacity != window.lastOpacity || window.atlasDamage.size() <= (size_t)imageIndex ||
+                             !IsRectEmpty(&window.atlasDamage[imageIndex]);
+            }
+            if (!hasChanges) {
+                return;
+            }
+
+            ID3D11Texture2D* atlasImage = m_atlas.imagesOnCompositionDevice[imageIndex].Get();
+            ID3D11UnorderedAccessView* atlasView = m_atlas.viewsOnCompositionDevice[imageIndex].Get();
+            for (uint32_t windowIndex : m_sortedWindows) {
+                auto& window = m_windows[windowIndex];
+                if (!window.isInAtlas || !window.captureWindow) {
+                    continue;
+                }
+                ID3D11Texture2D* windowSurface = window.captureWindow->getLastSurface();
+                if (!windowSurface) {
+                    continue;
+                }
+
+                D3D11_TEXTURE2D_DESC windowSurfaceDesc;
+                windowSurface->GetDesc(&windowSurfaceDesc);
+
+                // Never write past the region of the window (until it is moved to a larger one).
+                const uint32_t downscale = GetCopyDownscale(window);
+                const ovrRecti& rect = window.atlasRect.value();
+                D3D11_BOX box = GetContentBox(window, windowIndex, windowSurfaceDesc);
+                box.right = std::min(box.right, (UINT)rect.Size.w * downscale);
+                box.bottom = std::min(box.bottom, (UINT)rect.Size.h * downscale);
+                const ovrSizei size = {(int)((box.right + downscale - 1) / downscale),
+                                       (int)((box.bottom + downscale - 1) / downscale)};
+
+                const uint64_t frameGeneration = window.captureWindow->getFrameGeneration();
+                const bool isNewContent =
+                    frameGeneration != window.lastFrameGeneration || window.opacity != window.lastOpacity;
+                const D3D11_BOX region = GetDamagedRegion(
+                    window, window.atlasDamage, m_atlas.imagesOnCompositionDevice.size(), imageIndex, box, size);
+
+                QueueCopy(window,
+                          windowIndex,
+                          windowSurface,
+                          windowSurfaceDesc,
+                          box,
+                          region,
+                          atlasImage,
+                          atlasView,
+                          rect.Pos,
+                          false);
+                gpuTimer.usedSlots.push_back(windowIndex);
+
+                window.contentViewport = {rect.Pos, size};
+                window.isAtlasContentReady = true;
+                if (isNewContent) {
+                    window.lastFrameGeneration = frameGeneration;
+                    window.lastOpacity = window.opacity;
+                    ScheduleWindowUpdate(window, now);
+                }
+            }
+            m_isAtlasDirty = true;
+        }
+
+        // Commit the atlas, and point the windows in the atlas to their region.
+        void CommitAtlas() {
+            CHECK_OVRCMD(m_dispatchTable.ovr_CommitTextureSwapChain(m_ovrSession, m_atlas.handle));
+            m_atlasReadyFenceValue = 0;
+
+            for (uint32_t i : m_activeSlots) {
+                auto& window = m_windows[i];
+                if (window.isInAtlas && window.isAtlasContentReady) {
+                    window.quad.ColorTexture = m_atlas.handle;
+                    window.quad.Viewport = window.contentViewport;
+                    ReleaseSwapchain(window.swapchain);
+                    ReleaseSwapchain(window.retiredSwapchain);
+                }
+            }
+
+            m_wakeCompositionThread = true;
+        }
+
+        // Move small windows into the atlas, and the others out of it.
+        void UpdateWindowAtlas(Window& window) {
+            const uint32_t downscale = window.downscale;
+            const ovrSizei size = {(int)((window.lastContentSize.w + downscale - 1) / downscale),
+                                   (int)((window.lastContentSize.h + downscale - 1) / downscale)};
+            const bool isAtlasWanted = window.captureWindow && !window.isDirectCapture && !window.isSnapshot &&
+                                       window.captureFormat != DXGI_FORMAT_R16G16B16A16_FLOAT && size.w > 0 &&
+                                       size.h > 0 && size.w <= AtlasMaxItemSize && size.h <= AtlasMaxItemSize;
+            if (window.isInAtlas && isAtlasWanted && size.w <= window.atlasRect->Size.w &&
+                size.h <= window.atlasRect->Size.h) {
+                return;
+            }
+
+            if (window.isInAtlas) {
+                // Keep displaying the current region until the window has a new region or its own swapchain.
+                window.isInAtlas = false;
+                window.lastFrameGeneration = 0;
+                if (window.quad.ColorTexture != m_atlas.handle) {
+                    FreeAtlasRect(window);
+                }
+            }
+
+            if (isAtlasWanted) {
+                const std::optional<ovrRecti> rect = m_atlasAllocator->allocate(size);
+                if (!rect) {
+                    return;
+                }
+                if (window.atlasRect) {
+                    FreeAtlasRect(window);
+                }
+                window.atlasRect = rect;
+                window.atlasDamage.clear();
+                window.isInAtlas = true;
+                window.isAtlasContentReady = false;
+                window.lastFrameGeneration = 0;
+                m_wakeCompositionThread = true;
+            }
+        }
+
+        void FreeAtlasRect(Window& window) {
+            if (window.atlasRect && m_atlasAllocator) {
+                m_atlasAllocator->free(window.atlasRect.value());
+                window.atlasRect.reset();
+            }
+        }
+
+        // Make sure the swapchain of the window can hold the content. Returns false if a new swapchain is being
+        // created in the background, in which case the current swapchain remains displayed.
+        bool PrepareWindowSwapchain(Window& window, uint32_t slot, const D3D11_TEXTURE2D_DESC& windowSurfaceDesc) {
+            const uint32_t downscale = GetCopyDownscale(window);
+            const ovrSizei contentPixelSize = {(int)((windowSurfaceDesc.Width + downscale - 1) / downscale),
+                                               (int)((windowSurfaceDesc.Height + downscale - 1) / downscale)};
+            // Snapshots go into a static swapchain, which is never reused once committed.
+            if (fitsSwapchain(window.swapchain, contentPixelSize, windowSurfaceDesc.Format, window.isSnapshot) ||
+                AcquirePooledSwapchain(window, contentPixelSize, windowSurfaceDesc.Format, window.isSnapshot)) {
+                return true;
+            }
+
+            StagingWork work;
+            work.slot = slot;
+            work.stagingId = window.stagingId;
+            work.isSwapchainRequest = true;
+            work.isStaticSwapchain = window.isSnapshot;
+            work.swapchainDesc = windowSurfaceDesc;
+            work.swapchainDesc.Width = roundUp(contentPixelSize.w, SwapchainSizeGranularity);
+            work.swapchainDesc.Height = roundUp(contentPixelSize.h, SwapchainSizeGranularity);
+            StageWork(std::move(work));
+            window.hasSwapchainRequest = true;
+            return false;
+        }
+
+        // Poll the capture of a window captured on the submission device and copy the new content into its swapchain
+        // image. This is done on the submission context, so it must run on the render thread. Returns true if there
+        // is a new image to commit.
+        bool CopyDirectWindowContent(Window& window, uint32_t slot, GpuTimer& gpuTimer) {
+            const int64_t now = getQpcTime();
+            if (window.hasSwapchainRequest || !IsWindowUpdateDue(window, now)) {
+                return false;
+            }
+
+            ID3D11Texture2D* windowSurface = window.captureWindow->getSurface();
+            if (!windowSurface) {
+                return false;
+            }
+
+            // The window was resized.
+            const ovrSizei contentSize = window.captureWindow->getContentSize();
+            if (contentSize.w != window.lastContentSize.w || contentSize.h != window.lastContentSize.h) {
+                m_windowGeometry->refresh(slot);
+                window.lastContentSize = contentSize;
+            }
+
+            D3D11_TEXTURE2D_DESC windowSurfaceDesc;
+            windowSurface->GetDesc(&windowSurfaceDesc);
+            if (!PrepareWindowSwapchain(window, slot, windowSurfaceDesc)) {
+                return false;
+            }
+
+            const uint64_t frameGeneration = window.captureWindow->getFrameGeneration();
+            if (frameGeneration == window.lastFrameGeneration) {
+                return false;
+            }
+
+            int imageIndex = 0;
+            CHECK_OVRCMD(
+                m_dispatchTable.ovr_GetTextureSwapChainCurrentIndex(m_ovrSession, window.swapchain.handle, &imageIndex));
+            const D3D11_BOX box = GetContentBox(window, slot, windowSurfaceDesc);
+            const D3D11_BOX region = GetDamagedRegion(window,
+                                                      window.swapchain.damage,
+                                                      window.swapchain.imagesOnSubmissionDevice.size(),
+                                                      imageIndex,
+                                                      box,
+                                                      {(int)box.right, (int)box.bottom});
+
+            // This is the only copy of the content: the capture surface and the swapchain image are both on the
+            // submission device, with no synchronization needed with the composition device.
+            m_submissionContext->End(gpuTimer.start[slot].Get());
+            if (region.left < region.right && region.top < region.bottom) {
+                m_submissionContext->CopySubresourceRegion(window.swapchain.imagesOnSubmissionDevice[imageIndex].Get(),
+                                                           0,
+                                                           region.left,
+                                                           region.top,
+                                                           0,
+                                                           windowSurface,
+                                                           0,
+                                                           &region);
+            }
+            m_submissionContext->End(gpuTimer.end[slot].Get());
+            gpuTimer.usedSlots.push_back(slot);
+
+            window.lastFrameGeneration = frameGeneration;
+            window.lastOpacity = window.opacity;
+            window.contentViewport.Pos = {0, 0};
+            window.contentViewport.Size = {(int)box.right, (int)box.bottom};
+            ScheduleWindowUpdate(window, now);
+            return true;
+        }
+
+        // The minimum time between two updates of the window content (QPC time), or 0 to update at every frame.
+        double GetWindowUpdateInterval(const Window& window) const {
+            double interval = window.refreshRate ? m_qpcFrequency / window.refreshRate : 0.0;
+            if (window.throttle > 1) {
+                interval = std::max(interval, m_frameTime) * window.throttle;
+            }
+            return interval;
+        }
+
+        bool IsWindowUpdateDue(const Window& window, int64_t now) const {
+            // Allow half a frame early, so that rates close to a divider of the display rate do not skip a frame.
+            return now + (int64_t)(m_frameTime / 2) >= window.nextUpdateTime;
+        }
+
+        // Keep a steady cadence after updating the window content, unless we fell behind.
+        void ScheduleWindowUpdate(Window& window, int64_t now) {
+            const int64_t interval = (int64_t)GetWindowUpdateInterval(window);
+            const int64_t nextUpdateTime = window.nextUpdateTime + interval;
+            window.nextUpdateTime = nextUpdateTime > now ? nextUpdateTime : now + interval;
+        }
+
+        // Tell the capture how often the window content is needed.
+        void ApplyWindowUpdateInterval(Window& window) {
+            if (window.captureWindow) {
+                window.captureWindow->setMinUpdateInterval(std::chrono::microseconds(
+                    (int64_t)(GetWindowUpdateInterval(window) * 1000000.0 / m_qpcFrequency)));
+            }
+        }
+
+        // Throttle the overlays when their composition takes more GPU time than the budget. The overlays further away
+        // are throttled first, and the overlay with focus is never throttled.
+        void UpdateGpuBudget() {
+            if (++m_framesSinceGpuBudgetCheck < GpuBudgetInterval) {
+                return;
+            }
+            const float gpuTimePerFrame = m_gpuTimeSinceGpuBudgetCheck * 1000.f / m_framesSinceGpuBudgetCheck;
+            m_gpuTimeSinceGpuBudgetCheck = 0.f;
+            m_framesSinceGpuBudgetCheck = 0;
+
+            for (uint32_t i : m_sortedWindows) {
+                auto& window = m_windows[i];
+                if (window.hasFocus && window.throttle > 1) {
+                    window.throttle = 1;
+                    ApplyWindowUpdateInterval(window);
+                }
+            }
+
+            if (gpuTimePerFrame > m_gpuBudget) {
+                // Sorted from back to front.
+                for (uint32_t i : m_sortedWindows) {
+                    auto& window = m_windows[i];
+                    if (!window.hasFocus && window.throttle < MaxThrottle) {
+                        window.throttle *= 2;
+                        ApplyWindowUpdateInterval(window);
+                        LogVerbose("Over GPU budget (%.0f us): throttling window %u to 1/%u\n",
+                                   gpuTimePerFrame,
+                                   i,
+                                   window.throttle);
+                        break;
+                    }
+                }
+            } else if (gpuTimePerFrame < m_gpuBudget * GpuBudgetRelaxThreshold) {
+                for (auto it = m_sortedWindows.rbegin(); it != m_sortedWindows.rend(); ++it) {
+                    auto& window = m_windows[*it];
+                    if (window.throttle > 1) {
+                        window.throttle /= 2;
+                        ApplyWindowUpdateInterval(window);
+                        break;
+                    }
+                }
+            }
+        }
+
+        bool HasDirtyWindows() const {
+            return m_isAtlasDirty || std::any_of(m_activeSlots.cbegin(), m_activeSlots.cend(), [&](uint32_t i) {
+                       return m_windows[i].isDirty;
+                   });
+        }
+
+        // Signal the completion of the composition work for the windows that were updated.
+        void PublishWindowsContent() {
+            m_submissionFenceValue++;
+            CHECK_HRCMD(m_compositionContext->Signal(m_fenceOnCompositionDevice.Get(), m_submissionFenceValue));
+            for (uint32_t i : m_activeSlots) {
+                auto& window = m_windows[i];
+                if (window.isDirty) {
+                    // With asynchronous composition, the window may have let go of the swapchain in the meantime.
+                    if (window.swapchain.handle == window.dirtySwapchain) {
+                        window.readyFenceValue = m_submissionFenceValue;
+                    } else {
+                        window.lastFrameGeneration = 0;
+                    }
+                    window.isDirty = false;
+                }
+            }
+            if (m_isAtlasDirty) {
+                m_atlasReadyFenceValue = m_submissionFenceValue;
+                m_isAtlasDirty = false;
+            }
+        }
+
+        // Create the swapchain and other resources appropriate for a window. This may be called from the staging thread.
+        WindowSwapchain CreateWindowSwapchain(const D3D11_TEXTURE2D_DESC& windowSurfaceDesc, bool isStatic) {
+            WindowSwapchain result;
+
+            ovrTextureSwapChainDesc swapchainDesc{};
+            swapchainDesc.Type = ovrTexture_2D;
+            swapchainDesc.Format = dxgiToOvrTextureFormat(getSrgbFormat(windowSurfaceDesc.Format));
+            swapchainDesc.Width = windowSurfaceDesc.Width;
+            swapchainDesc.Height = windowSurfaceDesc.Height;
+            swapchainDesc.ArraySize = swapchainDesc.MipLevels = swapchainDesc.SampleCount = 1;
+            swapchainDesc.MiscFlags = ovrTextureMisc_DX_Typeless;
+            swapchainDesc.StaticImage = isStatic ? ovrTrue : ovrFalse;
+            // For the purposes of our transparency shader.
+            swapchainDesc.BindFlags = ovrTextureBind_DX_UnorderedAccess;
+            CHECK_OVRCMD(m_dispatchTable.ovr_CreateTextureSwapChainDX(
+                m_ovrSession, m_submissionDevice.Get(), &swapchainDesc, &result.handle));
+
+            // Share the textures with the composition device.
+            int length = 0;
+            CHECK_OVRCMD(m_dispatchTable.ovr_GetTextureSwapChainLength(m_ovrSession, result.handle, &length));
+            for (int j = 0; j < length; j++) {
+                ComPtr<ID3D11Texture2D> swapchainTexture;
+                CHECK_OVRCMD(m_dispatchTable.ovr_GetTextureSwapChainBufferDX(
+                    m_ovrSession, result.handle, j, IID_PPV_ARGS(swapchainTexture.ReleaseAndGetAddressOf())));
+                result.imagesOnSubmissionDevice.push_back(swapchainTexture.Get());
+
+                ComPtr<IDXGIResource1> dxgiResource;
+                CHECK_HRCMD(swapchainTexture->QueryInterface(IID_PPV_ARGS(dxgiResource.ReleaseAndGetAddressOf())));
+
+                HANDLE textureHandle;
+                CHECK_HRCMD(dxgiResource->GetSharedHandle(&textureHandle));
+
+                ComPtr<ID3D11Texture2D> compositionTexture;
+                CHECK_HRCMD(m_compositionDevice->OpenSharedResource(
+                    textureHandle, IID_PPV_ARGS(compositionTexture.ReleaseAndGetAddressOf())));
+                result.imagesOnCompositionDevice.push_back(compositionTexture.Get());
+
+                ComPtr<ID3D11UnorderedAccessView> uav;
+                {
+                    D3D11_UNORDERED_ACCESS_VIEW_DESC desc{};
+                    desc.ViewDimension = D3D11_UAV_DIMENSION_TEXTURE2D;
+                    desc.Format = windowSurfaceDesc.Format;
+                    desc.Texture2D.MipSlice = 0;
+                    CHECK_HRCMD(m_compositionDevice->CreateUnorderedAccessView(
+                        compositionTexture.Get(), &desc, uav.ReleaseAndGetAddressOf()));
+                }
+                result.viewsOnCompositionDevice.push_back(uav);
+            }
+
+            result.size.w = windowSurfaceDesc.Width;
+            result.size.h = windowSurfaceDesc.Height;
+            result.format = windowSurfaceDesc.Format;
+            result.isStatic = isStatic;
+
+            return result;
+        }
+
+        // Swap in a new swapchain for the window. This does not call LibOVR, so it may run on the composition thread.
+        void InstallWindowSwapchain(Window& window, WindowSwapchain& swapchain) {
+            // The current swapchain remains displayed until the new one is committed. If there is already a retired
+            // swapchain, the current one was never committed and it can be reused right away.
+            if (window.retiredSwapchain.handle) {
+                ReleaseSwapchain(window.swapchain);
+            } else {
+                window.retiredSwapchain = std::exchange(window.swapchain, {});
+            }
+
+            window.swapchain = std::exchange(swapchain, {});
+            window.surfaceViews.clear();
+            window.hasSwapchainRequest = false;
+
+            // Force a copy into the new swapchain.
+            window.lastFrameGeneration = 0;
+        }
+
+        void DestroyWindowSwapchain(WindowSwapchain& swapchain) {
+            if (swapchain.handle) {
+                m_dispatchTable.ovr_DestroyTextureSwapChain(m_ovrSession, swapchain.handle);
+                swapchain = {};
+            }
+        }
+
+        // Reuse the smallest unused swapchain that can hold the content.
+        bool AcquirePooledSwapchain(Window& window, const ovrSizei& size, DXGI_FORMAT format, bool isStatic) {
+            auto best = m_swapchainPool.end();
+            for (auto it = m_swapchainPool.begin(); it != m_swapchainPool.end(); ++it) {
+                // The composition thread may still be recording a copy into a swapchain released in the meantime.
+                if (std::find(m_composingSwapchains.cbegin(), m_composingSwapchains.cend(), it->handle) !=
+                    m_composingSwapchains.cend()) {
+                    continue;
+                }
+                if (fitsSwapchain(*it, size, format, isStatic) &&
+                    (best == m_swapchainPool.end() || it->size.w * it->size.h < best->size.w * best->size.h)) {
+                    best = it;
+                }
+            }
+            if (best == m_swapchainPool.end()) {
+                return false;
+            }
+
+            InstallWindowSwapchain(window, *best);
+            m_swapchainPool.erase(best);
+            return true;
+        }
+
+        // Give up a swapchain for reuse by any window. The pool is trimmed later on the render thread.
+        void ReleaseSwapchain(WindowSwapchain& swapchain) {
+            if (swapchain.handle) {
+                m_swapchainPool.push_back(std::exchange(swapchain, {}));
+            }
+        }
+
+        void TrimSwapchainPool() {
+            // Static swapchains are cheap to recreate, and most of them cannot be reused anyway.
+            for (auto it = m_swapchainPool.begin(); it != m_swapchainPool.end();) {
+                if (it->isStatic) {
+                    DestroyWindowSwapchain(*it);
+                    it = m_swapchainPool.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            while (m_swapchainPool.size() > MaxPooledSwapchains) {
+                DestroyWindowSwapchain(m_swapchainPool.front());
+                m_swapchainPool.erase(m_swapchainPool.begin());
+            }
+        }
+
+        void ClearSwapchainPool() {
+            for (auto& swapchain : m_swapchainPool) {
+                DestroyWindowSwapchain(swapchain);
+            }
+            m_swapchainPool.clear();
+        }
+
+        void StageWork(StagingWork&& work) {
+            {
+                std::unique_lock lock(m_stagingMutex);
+                m_stagingRequests.push_back(std::move(work));
+            }
+            SetEvent(m_stagingEvent.get());
+        }
+
+        // Swap in the resources that were created in the background.
+        void CollectStagedResources() {
+            {
+                std::unique_lock lock(m_stagingMutex);
+                if (m_stagingResults.empty()) {
+                    return;
+                }
+                std::swap(m_stagingResults, m_collectedResults);
+            }
+
+            for (auto& work : m_collectedResults) {
+                auto& window = m_windows[work.slot];
+
+                // The window was closed in the meantime.
+                if (!window.IsValid() || window.stagingId != work.stagingId) {
+                    ReleaseSwapchain(work.swapchain);
+                    continue;
+                }
+
+                if (work.hwnd || work.monitor) {
+                    if (!work.captureWindow) {
+                        // Keep the current capture, if any, and try again later.
+                        ScheduleCaptureRetry(window, work.slot);
+                        continue;
+                    }
+                    window.captureWindow = std::move(work.captureWindow);
+                    window.captureWindow->setTransferDownscale(window.downscale);
+                    window.isDirectCapture = work.isDirectCapture;
+                    window.captureFormat = work.captureFormat;
+                    window.colorScale =
+                        work.captureFormat == DXGI_FORMAT_R16G16B16A16_FLOAT ? window.hdrColorScale : 1.f;
+                    window.hasCaptureRequest = false;
+                    window.nextCaptureRetryTime = 0;
+                    window.captureRetryDelay = 0;
+                    window.surfaceViews.clear();
+                    window.lastFrameGeneration = 0;
+                    ApplyWindowUpdateInterval(window);
+                    m_wakeCompositionThread = true;
+                }
+                if (work.isSwapchainRequest) {
+                    if (!work.swapchain.handle) {
+                        work.swapchain = CreateWindowSwapchain(work.swapchainDesc, work.isStaticSwapchain);
+                    }
+                    InstallWindowSwapchain(window, work.swapchain);
+                    m_wakeCompositionThread = true;
+                }
+            }
+            m_collectedResults.clear();
+        }
+
+        void StartStagingThread() {
+            m_stopStagingEvent.ResetEvent();
+            m_stagingThread = std::thread([this]() { StagingThread(); });
+        }
+
+        void StopStagingThread() {
+            if (!m_stagingThread.joinable()) {
+                return;
+            }
+            m_stopStagingEvent.SetEvent();
+            m_stagingThread.join();
+
+            // Drop anything that was not swapped in yet.
+            m_stagingRequests.clear();
+            for (auto& work : m_stagingResults) {
+                DestroyWindowSwapchain(work.swapchain);
+            }
+            m_stagingResults.clear();
+        }
+
+        // The staging thread creates the captures and the swapchains, which take tens of milliseconds.
+        void StagingThread() {
+            winrt::init_apartment(winrt::apartment_type::multi_threaded);
+
+            const HANDLE events[] = {m_stagingEvent.get(), m_stopStagingEvent.get()};
+            while (WaitForMultipleObjects(ARRAYSIZE(events), events, false, INFINITE) == WAIT_OBJECT_0) {
+                while (true) {
+                    StagingWork work;
+                    {
+                        std::unique_lock lock(m_stagingMutex);
+                        if (m_stagingRequests.empty()) {
+                            break;
+                        }
+                        work = std::move(m_stagingRequests.front());
+                        m_stagingRequests.erase(m_stagingRequests.begin());
+                    }
+
+                    try {
+                        // Direct captures are polled by the render thread and do not wake the composition thread.
+                        ID3D11Device* const captureDevice =
+                            work.isDirectCapture ? m_submissionDevice.Get() : m_compositionDevice.Get();
+                        const HANDLE frameArrivedEvent = work.isDirectCapture ? nullptr : m_frameArrivedEvent.get();
+                        const auto createCapture = [&](const CaptureWindow::OwningAdapter* owningAdapter) {
+                            if (work.hwnd) {
+                                work.captureWindow = std::make_unique<CaptureWindow>(
+                                    captureDevice, work.hwnd, work.captureFormat, frameArrivedEvent, owningAdapter);
+                            } else if (work.monitor) {
+                                work.captureWindow = std::make_unique<CaptureWindow>(
+                                    captureDevice, work.monitor, work.captureFormat, frameArrivedEvent, owningAdapter);
+                            }
+                        };
+
+                        // Direct captures are copied on the submission device, and must be captured on its adapter.
+                        // When anything fails on the owning adapter, capture on the composition device instead.
+                        if (m_useCrossAdapterCapture && !work.isDirectCapture && (work.hwnd || work.monitor)) {
+                            try {
+                                const HMONITOR monitor =
+                                    work.monitor ? work.monitor
+                                                 : MonitorFromWindow(work.hwnd, MONITOR_DEFAULTTONEAREST);
+                                const std::optional<CaptureWindow::OwningAdapter> owningAdapter =
+                                    GetOwningAdapter(monitor);
+                                if (owningAdapter) {
+                                    createCapture(&owningAdapter.value());
                                 }
+                            } catch (std::exception& exc) {
+                                LogError("Cross-adapter capture error: %s\n", exc.what());
+                            } catch (winrt::hresult_error& exc) {
+                                LogError("Cross-adapter capture error: %X\n", (uint32_t)exc.code().value);
                             }
-                            m_isDraggingWindow = true;
-                        } else {
-                            // Reorient the window with the joystick.
-                            const ovrVector2f& thumbstick = input.Thumbstick[side];
-                            float yaw, pitch, roll;
-                            OVR::Quatf(window.quad.QuadPoseCenter.Orientation).GetYawPitchRoll(&yaw, &pitch, &roll);
-                            // TODO: Need temporal component - frame rate isn't stable.
-                            yaw += thumbstick.x * (float)MATH_DOUBLE_TWOPI / 360;
-                            pitch += -thumbstick.y * (float)MATH_DOUBLE_TWOPI / 360;
-                            window.quad.QuadPoseCenter.Orientation = geom::RotationRollPitchYaw({pitch, yaw, 0});
                         }
-                        geom::alignToGravity(window.quad.QuadPoseCenter);
-                    } else {
-                        // Two handed grab is used to resize the overlay.
-                        if (isResizingWindow) {
-                            const float lastLength =
-                                (m_lastControllerPoses[0].Translation - m_lastControllerPoses[1].Translation).Length();
-                            const float currentLength =
-                                (controllerPoses[0].Translation - controllerPoses[1].Translation).Length();
-                            const float delta = currentLength - lastLength;
+                        if (!work.captureWindow) {
+                            createCapture(nullptr);
+                        }
+                        // Otherwise, the swapchain is created on the render thread.
+                        if (work.isSwapchainRequest && m_canStageSwapchains) {
+                            work.swapchain = CreateWindowSwapchain(work.swapchainDesc, work.isStaticSwapchain);
+                        }
+                    } catch (std::exception& exc) {
+                        LogError("Staging thread error: %s\n", exc.what());
+                    } catch (winrt::hresult_error& exc) {
+                        LogError("Staging thread error: %X\n", (uint32_t)exc.code().value);
+                    }
 
-                            window.scale += delta * ScaleMultiplier;
+                    std::unique_lock lock(m_stagingMutex);
+                    m_stagingResults.push_back(std::move(work));
+                }
+            }
+
+            winrt::uninit_apartment();
+        }
+
+        // Find the device of the adapter driving a monitor, when it is not the adapter of the composition device.
+        // Windows spanning several monitors are captured on the adapter of the one they mostly cover. Only called from
+        // the staging thread.
+        std::optional<CaptureWindow::OwningAdapter> GetOwningAdapter(HMONITOR monitor) {
+            ComPtr<IDXGIFactory1> factory;
+            CHECK_HRCMD(CreateDXGIFactory1(IID_PPV_ARGS(factory.ReleaseAndGetAddressOf())));
+            ComPtr<IDXGIAdapter1> adapter;
+            for (UINT i = 0; factory->EnumAdapters1(i, adapter.ReleaseAndGetAddressOf()) == S_OK; i++) {
+                ComPtr<IDXGIOutput> output;
+                for (UINT j = 0; adapter->EnumOutputs(j, output.ReleaseAndGetAddressOf()) == S_OK; j++) {
+                    DXGI_OUTPUT_DESC desc;
+                    if (FAILED(output->GetDesc(&desc)) || desc.Monitor != monitor) {
+                        continue;
+                    }
+
+                    DXGI_ADAPTER_DESC1 adapterDesc;
+                    CHECK_HRCMD(adapter->GetDesc1(&adapterDesc));
+                    const auto isSameLuid = [&](const LUID& luid) {
+                        return luid.LowPart == adapterDesc.AdapterLuid.LowPart &&
+                               luid.HighPart == adapterDesc.AdapterLuid.HighPart;
+                    };
+                    if (isSameLuid(m_compositionAdapterLuid)) {
+                        return {};
+                    }
+                    for (const auto& owningAdapter : m_owningAdapters) {
+                        if (isSameLuid(owningAdapter.luid)) {
+                            return CaptureWindow::OwningAdapter{owningAdapter.device.Get(),
+                                                                owningAdapter.context.Get(),
+                                                                owningAdapter.downscaleShader.Get()};
                         }
-                        m_isResizingWindow = true;
                     }
+
+                    Log("Capturing %ls on adapter: %ls\n", desc.DeviceName, adapterDesc.Description);
+                    ComPtr<ID3D11Device> device;
+                    ComPtr<ID3D11DeviceContext> context;
+                    D3D_FEATURE_LEVEL featureLevel = D3D_FEATURE_LEVEL_11_0;
+                    UINT flags = D3D11_CREATE_DEVICE_BGRA_SUPPORT;
+#ifdef _DEBUG
+                    flags |= D3D11_CREATE_DEVICE_DEBUG;
+#endif
+                    CHECK_HRCMD(D3D11CreateDevice(adapter.Get(),
+                                                  D3D_DRIVER_TYPE_UNKNOWN,
+                                                  0,
+                                                  flags,
+                                                  &featureLevel,
+                                                  1,
+                                                  D3D11_SDK_VERSION,
+                                                  device.ReleaseAndGetAddressOf(),
+                                                  nullptr,
+                                                  context.ReleaseAndGetAddressOf()));
+                    OwningAdapterDevice owningAdapter;
+                    owningAdapter.luid = adapterDesc.AdapterLuid;
+                    CHECK_HRCMD(device.As(&owningAdapter.device));
+                    CHECK_HRCMD(context.As(&owningAdapter.context));
+                    CHECK_HRCMD(device->CreateComputeShader(g_TransparencyShaderDownscale,
+                                                            sizeof(g_TransparencyShaderDownscale),
+                                                            nullptr,
+                                                            owningAdapter.downscaleShader.ReleaseAndGetAddressOf()));
+                    m_owningAdapters.push_back(owningAdapter);
+                    return CaptureWindow::OwningAdapter{
+                        owningAdapter.device.Get(), owningAdapter.context.Get(), owningAdapter.downscaleShader.Get()};
                 }
+            }
 
-                // No further interactions to be handled this frame.
+            return {};
+        }
+
+        // Update the quad layer for a window. The layer is only submitted once the swapchain has been committed.
+        void UpdateWindowLayout(Window& window) {
+            if (!window.quad.ColorTexture) {
                 return;
             }
 
-            // Handle mouse interactions inside the window.
-            const bool isInteractable = !window.isMinimized && window.isInteractable;
-            if (isInteractable) {
-                // Relocate our hit to be relative to the top-left corner of the window.
-                const ovrSizei sizeInPixels = window.captureWindow->getSize();
-                const POINT cursorPosition = geom::getUVCoordinates(
-                    hitPose.Translation, window.quad.QuadPoseCenter, window.quad.QuadSize, sizeInPixels);
+            if (!window.isMinimized) {
+                window.quad.QuadSize.x = window.scale;
+                window.quad.QuadSize.y = (window.scale * window.quad.Viewport.Size.h) / window.quad.Viewport.Size.w;
+            } else {
+                window.quad.QuadSize = {MinimizedIconSize, MinimizedIconSize};
+            }
 
-                // Check the window boundaries (remember: we offered a little margin when rendering the cursor).
-                if (cursorPosition.x > 0 && cursorPosition.x < sizeInPixels.w && cursorPosition.y > 0 &&
-                    cursorPosition.y < sizeInPixels.h) {
-                    const auto setCursorPos = [&]() {
-                        // Update the cursor position.
-                        // TODO: Why are coordinates off!?
-                        POINT clickPosition = cursorPosition;
-                        if (window.hwnd) {
-                            ClientToScreen(window.hwnd, &clickPosition);
-                        } else {
-                            MONITORINFO info{sizeof(MONITORINFO)};
-                            GetMonitorInfo(window.monitor, &info);
-                            clickPosition.x += info.rcMonitor.left;
-                            clickPosition.y += info.rcMonitor.top;
-                        }
-                        SetCursorPos(clickPosition.x, clickPosition.y);
-                    };
+            switch (window.placement) {
+            case WindowPlacement::HeadLocked:
+                window.quad.Header.Flags |= ovrLayerFlag_HeadLocked;
+                break;
 
-                    // Continuously update cursor position once an overlay has focus.
-                    if (window.hasFocus) {
-                        setCursorPos();
-                    }
+            default:
+                window.quad.Header.Flags &= ~ovrLayerFlag_HeadLocked;
+                break;
+            }
 
-                    // Simulate mouse button presses.
-                    const bool newDownEvent = (m_isPrimaryPressed && !wasPrimaryPressed) ||
-                                              (m_isSecondaryPressed && !wasSecondaryPressed) ||
-                                              (m_isThumbstickPressed && !wasThumbstickPressed);
-                    if (newDownEvent) {
-                        // Make sure the window can receive clicks.
-                        if (window.hwnd) {
-                            SetForegroundWindow(window.hwnd);
-                        }
-                        if (!window.hasFocus) {
-                            // Move the cursor to the destination window.
-                            setCursorPos();
-                        }
-                        window.hasFocus = true;
+            // Handle billboarding.
+            if (window.isMinimized && window.placement != WindowPlacement::HeadLocked) {
+                // Minimized window always faces us.
+                geom::facingCamera(window.quad.QuadPoseCenter, m_lastHeadPose);
+                geom::alignToGravity(window.quad.QuadPoseCenter);
+            }
 
-                        INPUT event{};
-                        event.type = INPUT_MOUSE;
-                        event.mi.dwFlags = m_isPrimaryPressed     ? MOUSEEVENTF_LEFTDOWN
-                                           : m_isSecondaryPressed ? MOUSEEVENTF_RIGHTDOWN
-                                                                  : MOUSEEVENTF_MIDDLEDOWN;
-                        SendInput(1, &event, sizeof(INPUT));
+            if (window.IsCurved()) {
+                UpdateWindowCylinder(window);
+            }
+        }
 
-                        // No further interactions to be handled this frame.
-                        return;
+        // Bend the quad layer into a cylinder layer.
+        void UpdateWindowCylinder(Window& window) {
+            const auto& quad = window.quad;
+            auto& source = window.cylinderSource;
+            if (window.cylinderGeometry.angle != window.curvature ||
+                memcmp(&source.QuadPoseCenter, &quad.QuadPoseCenter, sizeof(quad.QuadPoseCenter)) ||
+                memcmp(&source.QuadSize, &quad.QuadSize, sizeof(quad.QuadSize))) {
+                source.QuadPoseCenter = quad.QuadPoseCenter;
+                source.QuadSize = quad.QuadSize;
+                geom::updateCylinder(window.cylinderGeometry, quad.QuadPoseCenter, quad.QuadSize, window.curvature);
+            }
+
+            auto& cylinder = window.cylinder;
+            cylinder.Header.Type = ovrLayerType_Cylinder;
+            cylinder.Header.Flags = quad.Header.Flags;
+            cylinder.ColorTexture = quad.ColorTexture;
+            cylinder.Viewport = quad.Viewport;
+            cylinder.CylinderPoseCenter = window.cylinderGeometry.center;
+            cylinder.CylinderRadius = window.cylinderGeometry.radius;
+            cylinder.CylinderAngle = window.cylinderGeometry.angle;
+            cylinder.CylinderAspectRatio = quad.QuadSize.x / quad.QuadSize.y;
+        }
+
+        void StartCompositionThread() {
+            m_stopCompositionEvent.ResetEvent();
+            m_compositionThread = std::thread([this]() { CompositionThread(); });
+        }
+
+        void StopCompositionThread() {
+            if (!m_compositionThread.joinable()) {
+                return;
+            }
+            m_stopCompositionEvent.SetEvent();
+            m_compositionThread.join();
+        }
+
+        // The composition thread owns the composition context while running: it wakes up upon new captured frames
+        // and fills the next swapchain image of each window.
+        void CompositionThread() {
+            uint32_t errorCount = 0;
+            const HANDLE events[] = {m_frameArrivedEvent.get(), m_stopCompositionEvent.get()};
+            while (WaitForMultipleObjects(ARRAYSIZE(events), events, false, INFINITE) == WAIT_OBJECT_0) {
+                try {
+                    GpuTimer* gpuTimer;
+                    {
+                        std::unique_lock lock(m_compositionMutex);
+                        gpuTimer = &PrepareWindowsContent();
                     }
 
-                    const bool newUpEvent = (!m_isPrimaryPressed && wasPrimaryPressed) ||
-                                            (!m_isSecondaryPressed && wasSecondaryPressed) ||
-                                            (!m_isThumbstickPressed && wasThumbstickPressed);
-                    if (newUpEvent) {
-                        INPUT event{};
-                        event.type = INPUT_MOUSE;
-                        event.mi.dwFlags = wasPrimaryPressed     ? MOUSEEVENTF_LEFTUP
-                                           : wasSecondaryPressed ? MOUSEEVENTF_RIGHTUP
-                                                                 : MOUSEEVENTF_MIDDLEUP;
-                        SendInput(1, &event, sizeof(INPUT));
+                    // Recording the copies is the bulk of the work, and the render thread is free in the meantime.
+                    RecordWindowsContent(*gpuTimer);
 
-                        // No further interactions to be handled this frame.
-                        return;
+                    {
+                        std::unique_lock lock(m_compositionMutex);
+                        m_composingSwapchains.clear();
+                        if (HasDirtyWindows()) {
+                            PublishWindowsContent();
+                        }
                     }
+                    errorCount = 0;
+                    continue;
+                } catch (std::exception& exc) {
+                    LogError("Composition thread error: %s\n", exc.what());
+                } catch (winrt::hresult_error& exc) {
+                    LogError("Composition thread error: %X\n", (uint32_t)exc.code().value);
+                }
 
-                    // Simulate wheel.
-                    if (std::abs(input.Thumbstick[side].y) > 0.f) {
-                        INPUT event{};
-                        event.type = INPUT_MOUSE;
-                        event.mi.dwFlags = MOUSEEVENTF_WHEEL;
-                        event.mi.mouseData = (DWORD)(input.Thumbstick[side].y * WHEEL_DELTA * WheelMultiplier);
-                        SendInput(1, &event, sizeof(INPUT));
+                // Drop what was not recorded, and copy everything again on the next frame.
+                std::unique_lock lock(m_compositionMutex);
+                m_queuedCopies.clear();
+                m_composingSwapchains.clear();
+                for (uint32_t i : m_activeSlots) {
+                    m_windows[i].lastFrameGeneration = 0;
+                }
+                if (++errorCount >= MaxCompositionErrors) {
+                    // Update() takes over.
+                    m_isCompositionThreadFailed = true;
+                    return;
+                }
+                m_wakeCompositionThread = true;
+            }
+        }
+
+        // Start the GPU timer for this frame, after collecting the results from the oldest frame.
+        GpuTimer& BeginGpuTimer(ID3D11DeviceContext* context,
+                                std::array<GpuTimer, GpuTimerLatency>& timers,
+                                uint32_t& timerIndex) {
+            GpuTimer& timer = timers[timerIndex];
+            timerIndex = (timerIndex + 1) % GpuTimerLatency;
+
+            if (timer.isPending) {
+                // Never stall: if the results are not available yet, we drop them.
+                D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjoint{};
+                if (context->GetData(
+                        timer.disjoint.Get(), &disjoint, sizeof(disjoint), D3D11_ASYNC_GETDATA_DONOTFLUSH) == S_OK &&
+                    !disjoint.Disjoint) {
+                    for (uint32_t i : timer.usedSlots) {
+                        uint64_t start, end;
+                        if (context->GetData(
+                                timer.start[i].Get(), &start, sizeof(start), D3D11_ASYNC_GETDATA_DONOTFLUSH) == S_OK &&
+                            context->GetData(
+                                timer.end[i].Get(), &end, sizeof(end), D3D11_ASYNC_GETDATA_DONOTFLUSH) == S_OK) {
+                            const float gpuTime = (float)((end - start) * 1000.0 / disjoint.Frequency);
+                            m_gpuTimeStats[i].addSample(gpuTime);
+                            m_gpuTimeSinceGpuBudgetCheck += gpuTime;
+                        }
                     }
                 }
+                timer.isPending = false;
             }
+
+            timer.usedSlots.clear();
+            context->Begin(timer.disjoint.Get());
+            return timer;
         }
 
-        // Refresh the content of all windows.
-        void UpdateWindows() {
-            for (auto& windowIndex : m_sortedWindows) {
-                auto& window = m_windows[windowIndex];
+        // Publish the statistics to the memory mapped file.
+        void PublishStats() {
+            m_frameCount++;
+            if (!m_overlayStats || (m_frameCount % StatsPublishInterval)) {
+                return;
+            }
 
-                ID3D11Texture2D* windowSurface = window.captureWindow->getSurface();
-                if (!windowSurface) {
-                    continue;
+            // Computed before the write, so that the readers rarely need to try again.
+            shared::OverlayStats stats{};
+            stats.frameCount = m_frameCount;
+            stats.sortWindows = m_sortWindowsStats.compute();
+            stats.handleInteractions = m_handleInteractionsStats.compute();
+            stats.updateWindows = m_updateWindowsStats.compute();
+            stats.overlayCount = m_capacity;
+            for (uint32_t i = 0; i < m_capacity; i++) {
+                stats.gpuTime[i] = m_gpuTimeStats[i].compute();
+            }
+
+            shared::beginWrite(m_overlayStats->sequence);
+            stats.sequence = m_overlayStats->sequence;
+            *m_overlayStats = stats;
+            shared::endWrite(m_overlayStats->sequence);
+        }
+
+        // Pick the downscale factor for the window based on its approximate footprint on the headset panels.
+        void UpdateWindowDownscale(Window& window, uint32_t slot, float distance) {
+            if (!window.lastContentSize.w) {
+                return;
+            }
+
+            const float width = window.isMinimized ? MinimizedIconSize : window.scale;
+            const float footprint = 2.f * std::atan2(width / 2.f, std::max(distance, 0.01f)) * PanelPixelsPerRadian;
+            const float ratio = window.lastContentSize.w / std::max(footprint, 1.f);
+
+            // Use a dead band around each power of two to avoid recreating the swapchain back and forth.
+            uint32_t downscale = window.downscale;
+            while (downscale < MaxDownscale && ratio > downscale * 2 * DownscaleHysteresis) {
+                downscale *= 2;
+            }
+            while (downscale > 1 && ratio < downscale / DownscaleHysteresis) {
+                downscale /= 2;
+            }
+            if (downscale != window.downscale) {
+                LogVerbose("Window %u downscale: %u (footprint %.0f pixels)\n", slot, downscale, footprint);
+                window.downscale = downscale;
+                if (window.captureWindow) {
+                    window.captureWindow->setTransferDownscale(downscale);
                 }
+                window.lastFrameGeneration = 0;
+                m_wakeCompositionThread = true;
+            }
+        }
 
-                D3D11_TEXTURE2D_DESC windowSurfaceDesc;
-                windowSurface->GetDesc(&windowSurfaceDesc);
-                if (!window.swapchain || window.swapchainSize.w != windowSurfaceDesc.Width ||
-                    window.swapchainSize.h != windowSurfaceDesc.Height) {
-                    // Create the swapchain and other resources appropriate for the window.
-                    if (window.swapchain) {
-                        m_dispatchTable.ovr_DestroyTextureSwapChain(m_ovrSession, window.swapchain);
-                        window.swapchain = nullptr;
-                    }
-                    window.swapchainImagesOnSubmissionDevice.clear();
-                    window.swapchainImagesOnCompositionDevice.clear();
-
-                    ovrTextureSwapChainDesc swapchainDesc{};
-                    swapchainDesc.Type = ovrTexture_2D;
-                    swapchainDesc.Format = dxgiToOvrTextureFormat(windowSurfaceDesc.Format);
-                    swapchainDesc.Width = windowSurfaceDesc.Width;
-                    swapchainDesc.Height = windowSurfaceDesc.Height;
-                    swapchainDesc.ArraySize = swapchainDesc.MipLevels = swapchainDesc.SampleCount = 1;
-                    swapchainDesc.MiscFlags = ovrTextureMisc_DX_Typeless;
-                    // For the purposes of our transparency shader.
-                    swapchainDesc.BindFlags = ovrTextureBind_DX_UnorderedAccess;
-                    CHECK_OVRCMD(m_dispatchTable.ovr_CreateTextureSwapChainDX(
-                        m_ovrSession, m_submissionDevice.Get(), &swapchainDesc, &window.swapchain));
-
-                    // Share the textures with the composition device.
-                    int length = 0;
-                    CHECK_OVRCMD(
-                        m_dispatchTable.ovr_GetTextureSwapChainLength(m_ovrSession, window.swapchain, &length));
-                    for (int j = 0; j < length; j++) {
-                        ComPtr<ID3D11Texture2D> swapchainTexture;
-                        CHECK_OVRCMD(m_dispatchTable.ovr_GetTextureSwapChainBufferDX(
-                            m_ovrSession,
-                            window.swapchain,
-                            j,
-                            IID_PPV_ARGS(swapchainTexture.ReleaseAndGetAddressOf())));
-                        window.swapchainImagesOnSubmissionDevice.push_back(swapchainTexture.Get());
-
-                        ComPtr<IDXGIResource1> dxgiResource;
-                        CHECK_HRCMD(
-                            swapchainTexture->QueryInterface(IID_PPV_ARGS(dxgiResource.ReleaseAndGetAddressOf())));
-
-                        HANDLE textureHandle;
-                        CHECK_HRCMD(dxgiResource->GetSharedHandle(&textureHandle));
-
-                        ComPtr<ID3D11Texture2D> compositionTexture;
-                        CHECK_HRCMD(m_compositionDevice->OpenSharedResource(
-                            textureHandle, IID_PPV_ARGS(compositionTexture.ReleaseAndGetAddressOf())));
-                        window.swapchainImagesOnCompositionDevice.push_back(compositionTexture.Get());
-                    }
+        // Whether the window may be captured on the submission device: only opaque windows at full resolution, since
+        // the submission context is only used for plain copies.
+        bool IsDirectCaptureWanted(const Window& window) const {
+            return m_canDirectCapture && window.opacity >= 1.f - OpacityThreshold && !window.isColorKeyed &&
+                   window.downscale == 1 && GetCaptureFormat(window) != DXGI_FORMAT_R16G16B16A16_FLOAT;
+        }
+
+        // Capture in the format the desktop is composed in, to avoid a conversion by DWM for every frame. Color keys
+        // are given in sRGB, so color-keyed windows are always captured in 8-bit.
+        DXGI_FORMAT GetCaptureFormat(const Window& window) const {
+            if (window.hdrColorScale > 0.f && !window.isColorKeyed) {
+                return DXGI_FORMAT_R16G16B16A16_FLOAT;
+            }
+            return m_canWriteBgra ? DXGI_FORMAT_B8G8R8A8_UNORM : DXGI_FORMAT_R8G8B8A8_UNORM;
+        }
 
-                    window.quad.ColorTexture = window.swapchain;
-                    window.swapchainSize.w = windowSurfaceDesc.Width;
-                    window.swapchainSize.h = windowSurfaceDesc.Height;
+        // The SDR white scale for an HDR output, 0 for an SDR output.
+        float GetHdrColorScale(HMONITOR monitor) const {
+            for (const auto& output : m_hdrOutputs) {
+                if (output.first == monitor) {
+                    return output.second;
                 }
+            }
+            return 0.f;
+        }
 
-                D3D11_BOX box{};
-                box.back = 1;
-                if (window.hwnd) {
-                    RECT rc{};
-                    CHECK_HRCMD(DwmGetWindowAttribute(window.hwnd, DWMWA_EXTENDED_FRAME_BOUNDS, &rc, sizeof(rc)));
-                    box.right = rc.right - rc.left;
-                    box.bottom = rc.bottom - rc.top;
-                } else {
-                    box.right = windowSurfaceDesc.Width;
-                    box.bottom = windowSurfaceDesc.Height;
+        // Follow a window moved to another monitor, since the capture format and the color scale depend on its output.
+        // A change of capture format is then picked up by UpdateWindowCapture().
+        void UpdateWindowOutput(Window& window, uint32_t slot) {
+            if (!window.hwnd) {
+                return;
+            }
+            const HMONITOR monitor = m_windowGeometry->get(slot).monitor;
+            if (!monitor || monitor == window.outputMonitor) {
+                return;
+            }
+
+            window.outputMonitor = monitor;
+            const float hdrColorScale = GetHdrColorScale(monitor);
+            if (hdrColorScale != window.hdrColorScale) {
+                window.hdrColorScale = hdrColorScale;
+                if (window.captureFormat == DXGI_FORMAT_R16G16B16A16_FLOAT && hdrColorScale > 0.f) {
+                    // Still an HDR output, with another SDR white level.
+                    window.colorScale = hdrColorScale;
+                    window.lastFrameGeneration = 0;
+                    m_wakeCompositionThread = true;
                 }
+            }
+        }
 
-                int imageIndex = 0;
-                CHECK_OVRCMD(
-                    m_dispatchTable.ovr_GetTextureSwapChainCurrentIndex(m_ovrSession, window.swapchain, &imageIndex));
-                ID3D11Texture2D* swapchainImage = window.swapchainImagesOnCompositionDevice[imageIndex].Get();
-                if (window.opacity >= 1.f - OpacityThreshold) {
-                    // Copy without transparency.
-                    m_compositionContext->CopySubresourceRegion(swapchainImage, 0, 0, 0, 0, windowSurface, 0, &box);
-                } else {
-                    // Create ephemeral resources to run our transparency shader.
-                    ComPtr<ID3D11ShaderResourceView> srv;
-                    {
-                        D3D11_SHADER_RESOURCE_VIEW_DESC desc{};
-                        desc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
-                        desc.Format = windowSurfaceDesc.Format;
-                        desc.Texture2D.MipLevels = 1;
-                        CHECK_HRCMD(m_compositionDevice->CreateShaderResourceView(
-                            windowSurface, &desc, srv.ReleaseAndGetAddressOf()));
-                    }
-                    ComPtr<ID3D11UnorderedAccessView> uav;
-                    {
-                        D3D11_UNORDERED_ACCESS_VIEW_DESC desc{};
-                        desc.ViewDimension = D3D11_UAV_DIMENSION_TEXTURE2D;
-                        desc.Format = windowSurfaceDesc.Format;
-                        desc.Texture2D.MipSlice = 0;
-                        CHECK_HRCMD(m_compositionDevice->CreateUnorderedAccessView(
-                            swapchainImage, &desc, uav.ReleaseAndGetAddressOf()));
-                    }
+        // Move the capture of the window to the device and format appropriate for its current transparency and
+        // resolution. The new capture is created in the background.
+        void UpdateWindowCapture(Window& window, uint32_t slot) {
+            if (window.hasCaptureRequest || window.nextCaptureRetryTime || !window.captureWindow ||
+                (IsDirectCaptureWanted(window) == window.isDirectCapture &&
+                 GetCaptureFormat(window) == window.captureFormat)) {
+                return;
+            }
 
-                    // Setup the transparency.
-                    D3D11_MAPPED_SUBRESOURCE mappedResources;
-                    CHECK_HRCMD(m_compositionContext->Map(
-                        m_transparencyConstants.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResources));
-                    TransparencyShaderConstants transparency{};
-                    transparency.transparentColor = {-1, -1, -1};
-                    transparency.alpha = window.opacity;
-                    memcpy(mappedResources.pData, &transparency, sizeof(transparency));
-                    m_compositionContext->Unmap(m_transparencyConstants.Get(), 0);
-
-                    // Copy while doing transparency.
-                    m_compositionContext->CSSetShader(m_transparencyShader.Get(), nullptr, 0);
-                    m_compositionContext->CSSetShaderResources(0, 1, srv.GetAddressOf());
-                    m_compositionContext->CSSetConstantBuffers(0, 1, m_transparencyConstants.GetAddressOf());
-                    m_compositionContext->CSSetUnorderedAccessViews(0, 1, uav.GetAddressOf(), nullptr);
-                    m_compositionContext->Dispatch((unsigned int)std::ceil(windowSurfaceDesc.Width / 8),
-                                                   (unsigned int)std::ceil(windowSurfaceDesc.Height / 8),
-                                                   1);
-
-                    // Unbind all resources to avoid D3D validation errors.
-                    {
-                        m_compositionContext->CSSetShader(nullptr, nullptr, 0);
-                        ID3D11ShaderResourceView* nullSRV[] = {nullptr};
-                        m_compositionContext->CSSetShaderResources(0, 1, nullSRV);
-                        ID3D11Buffer* nullCBV[] = {nullptr};
-                        m_compositionContext->CSSetConstantBuffers(0, 1, nullCBV);
-                        ID3D11UnorderedAccessView* nullUAV[] = {nullptr};
-                        m_compositionContext->CSSetUnorderedAccessViews(0, 1, nullUAV, nullptr);
+            RequestWindowCapture(window, slot);
+        }
+
+        void RequestWindowCapture(Window& window, uint32_t slot) {
+            StagingWork work;
+            work.slot = slot;
+            work.stagingId = window.stagingId;
+            work.hwnd = window.hwnd;
+            work.monitor = window.monitor;
+            work.isDirectCapture = IsDirectCaptureWanted(window);
+            work.captureFormat = GetCaptureFormat(window);
+            window.hasCaptureRequest = true;
+
+            // Hand over the capture from the previous session as if it was just created in the background.
+            if (!work.isDirectCapture) {
+                for (auto it = m_retainedCaptures.begin(); it != m_retainedCaptures.end(); ++it) {
+                    if (it->hwnd == work.hwnd && it->monitor == work.monitor &&
+                        it->captureFormat == work.captureFormat) {
+                        work.captureWindow = std::move(it->captureWindow);
+                        m_retainedCaptures.erase(it);
+                        std::unique_lock lock(m_stagingMutex);
+                        m_stagingResults.push_back(std::move(work));
+                        return;
                     }
                 }
+            }
+            StageWork(std::move(work));
+        }
+
+        // Back off exponentially, since some windows cannot be captured for a long time (or ever).
+        void ScheduleCaptureRetry(Window& window, uint32_t slot) {
+            window.hasCaptureRequest = false;
+            window.captureRetryDelay = std::clamp(window.captureRetryDelay * 2,
+                                                  (int64_t)(MinCaptureRetryDelay * m_qpcFrequency),
+                                                  (int64_t)(MaxCaptureRetryDelay * m_qpcFrequency));
+            window.nextCaptureRetryTime = getQpcTime() + window.captureRetryDelay;
+            Log("Retrying the capture of slot %u in %.1f s\n", slot, window.captureRetryDelay / m_qpcFrequency);
+        }
+
+        void UpdateWindowCaptureRetry(Window& window, uint32_t slot, int64_t now) {
+            if (!window.nextCaptureRetryTime || now < window.nextCaptureRetryTime) {
+                return;
+            }
+
+            window.nextCaptureRetryTime = 0;
+            RequestWindowCapture(window, slot);
+        }
+
+        // Free the capture once a snapshot was committed. The static swapchain keeps displaying it.
+        void ReleaseWindowCapture(Window& window) {
+            window.captureWindow.reset();
+            window.isDirectCapture = false;
+            window.surfaceViews.clear();
+            window.nextSnapshotTime = m_snapshotInterval ? getQpcTime() + m_snapshotInterval : 0;
+        }
+
+        // Capture the window again to take a new snapshot, or to go back to a live capture.
+        void UpdateWindowSnapshot(Window& window, uint32_t slot, int64_t now) {
+            if (window.captureWindow || window.hasCaptureRequest || !window.swapchain.isCommitted) {
+                // A snapshot is already underway.
+                window.isSnapshotRequested = false;
+                return;
+            }
+
+            if (!window.isSnapshot || window.isSnapshotRequested ||
+                (window.nextSnapshotTime && now >= window.nextSnapshotTime)) {
+                window.isSnapshotRequested = false;
+                RequestWindowCapture(window, slot);
+            }
+        }
+
+        // Copy the captured surface into the current swapchain image, applying transparency if needed.
+        void CopyWindowContent(Window& window,
+                               uint32_t slot,
+                               ID3D11Texture2D* windowSurface,
+                               const D3D11_TEXTURE2D_DESC& windowSurfaceDesc) {
+            const D3D11_BOX box = GetContentBox(window, slot, windowSurfaceDesc);
+
+            int imageIndex = 0;
+            CHECK_OVRCMD(
+                m_dispatchTable.ovr_GetTextureSwapChainCurrentIndex(m_ovrSession, window.swapchain.handle, &imageIndex));
+            ID3D11Texture2D* swapchainImage = window.swapchain.imagesOnCompositionDevice[imageIndex].Get();
+            const uint32_t downscale = GetCopyDownscale(window);
+            const UINT width = (box.right + downscale - 1) / downscale;
+            const UINT height = (box.bottom + downscale - 1) / downscale;
+            const D3D11_BOX region = GetDamagedRegion(window,
+                                                      window.swapchain.damage,
+                                                      window.swapchain.imagesOnCompositionDevice.size(),
+                                                      imageIndex,
+                                                      box,
+                                                      {(int)width, (int)height});
+            QueueCopy(window,
+                      slot,
+                      windowSurface,
+                      windowSurfaceDesc,
+                      box,
+                      region,
+                      swapchainImage,
+                      window.swapchain.viewsOnCompositionDevice[imageIndex].Get(),
+                      {0, 0},
+                      true);
+
+            window.contentViewport.Pos = {0, 0};
+            window.contentViewport.Size = {(int)width, (int)height};
+        }
 
-                window.quad.Viewport.Pos = {0, 0};
-                window.quad.Viewport.Size = {(int)box.right, (int)box.bottom};
-                if (!window.isMinimized) {
-                    window.quad.QuadSize.x = window.scale;
-                    window.quad.QuadSize.y = (window.scale * window.quad.Viewport.Size.h) / window.quad.Viewport.Size.w;
+        // Queue the copy of a region of the captured surface into a swapchain image, at the given position (in the
+        // pixels of the image), applying transparency and downscaling if needed. The region lies within the content
+        // box, which bounds the pixels read when downscaling.
+        void QueueCopy(Window& window,
+                       uint32_t slot,
+                       ID3D11Texture2D* windowSurface,
+                       const D3D11_TEXTURE2D_DESC& windowSurfaceDesc,
+                       const D3D11_BOX& contentBox,
+                       const D3D11_BOX& region,
+                       ID3D11Texture2D* image,
+                       ID3D11UnorderedAccessView* view,
+                       const ovrVector2i& destination,
+                       bool canCopyWithoutShader) {
+            QueuedCopy& copy = m_queuedCopies.emplace_back();
+            copy.slot = slot;
+            copy.surface = windowSurface;
+            copy.region = region;
+            copy.image = image;
+            copy.destination = destination;
+
+            const uint32_t downscale = GetCopyDownscale(window);
+            if (region.left >= region.right || region.top >= region.bottom) {
+                // Nothing changed since this image was last written.
+            } else if (canCopyWithoutShader && window.opacity >= 1.f - OpacityThreshold && !window.isColorKeyed &&
+                       downscale == 1 && window.colorScale == 1.f) {
+                // Copy without transparency.
+            } else {
+                copy.surfaceView = GetSurfaceView(window, windowSurface, windowSurfaceDesc);
+                copy.view = view;
+
+                // Setup the transparency.
+                TransparencyShaderConstants& transparency = copy.transparency;
+                if (window.isColorKeyed) {
+                    transparency.transparentColor = {((window.colorKey >> 16) & 0xff) / 255.f,
+                                                     ((window.colorKey >> 8) & 0xff) / 255.f,
+                                                     (window.colorKey & 0xff) / 255.f};
+                    // Add half a unit to absorb the UNORM conversion error.
+                    transparency.tolerance = (window.colorKeyTolerance + 0.5f) / 255.f;
                 } else {
-                    window.quad.QuadSize = {MinimizedIconSize, MinimizedIconSize};
+                    transparency.transparentColor = {-1, -1, -1};
                 }
+                transparency.alpha = window.opacity;
+                transparency.width = (region.right + downscale - 1) / downscale;
+                transparency.height = (region.bottom + downscale - 1) / downscale;
+                transparency.offsetX = region.left / downscale;
+                transparency.offsetY = region.top / downscale;
+                transparency.destOffsetX = destination.x;
+                transparency.destOffsetY = destination.y;
+                transparency.downscale = downscale;
+                transparency.colorScale = window.colorScale;
+                transparency.sourceWidth = contentBox.right;
+                transparency.sourceHeight = contentBox.bottom;
+
+                // A negative transparent color means constant alpha.
+                const bool useColorKey = transparency.transparentColor.x >= 0.f;
+                copy.shader = downscale > 1   ? m_downscaleShader.Get()
+                              : useColorKey ? m_colorKeyTransparencyShader.Get()
+                                            : m_transparencyShader.Get();
+            }
+        }
 
-                // We will commit the swapchain image after the fence signaling.
+        void RecordCopy(const QueuedCopy& copy) {
+            const D3D11_BOX& region = copy.region;
+            if (region.left >= region.right || region.top >= region.bottom) {
+                return;
+            }
 
-                switch (window.placement) {
-                case WindowPlacement::HeadLocked:
-                    window.quad.Header.Flags |= ovrLayerFlag_HeadLocked;
-                    break;
+            if (!copy.shader) {
+                m_compositionContext->CopySubresourceRegion(copy.image.Get(),
+                                                            0,
+                                                            copy.destination.x + region.left,
+                                                            copy.destination.y + region.top,
+                                                            0,
+                                                            copy.surface.Get(),
+                                                            0,
+                                                            &region);
+                return;
+            }
 
-                default:
-                    window.quad.Header.Flags &= ~ovrLayerFlag_HeadLocked;
-                    break;
+            D3D11_MAPPED_SUBRESOURCE mappedResources;
+            CHECK_HRCMD(m_compositionContext->Map(
+                m_transparencyConstants.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResources));
+            memcpy(mappedResources.pData, &copy.transparency, sizeof(copy.transparency));
+            m_compositionContext->Unmap(m_transparencyConstants.Get(), 0);
+
+            // Copy while doing transparency.
+            const TransparencyShaderConstants& transparency = copy.transparency;
+            ID3D11ShaderResourceView* srv = copy.surfaceView.Get();
+            ID3D11UnorderedAccessView* uav = copy.view.Get();
+            m_compositionContext->CSSetShader(copy.shader, nullptr, 0);
+            m_compositionContext->CSSetShaderResources(0, 1, &srv);
+            m_compositionContext->CSSetConstantBuffers(0, 1, m_transparencyConstants.GetAddressOf());
+            m_compositionContext->CSSetUnorderedAccessViews(0, 1, &uav, nullptr);
+            m_compositionContext->Dispatch(
+                (transparency.width - transparency.offsetX + TransparencyShaderGroupSize - 1) /
+                    TransparencyShaderGroupSize,
+                (transparency.height - transparency.offsetY + TransparencyShaderGroupSize - 1) /
+                    TransparencyShaderGroupSize,
+                1);
+
+            // Unbind all resources to avoid D3D validation errors.
+            {
+                m_compositionContext->CSSetShader(nullptr, nullptr, 0);
+                ID3D11ShaderResourceView* nullSRV[] = {nullptr};
+                m_compositionContext->CSSetShaderResources(0, 1, nullSRV);
+                ID3D11Buffer* nullCBV[] = {nullptr};
+                m_compositionContext->CSSetConstantBuffers(0, 1, nullCBV);
+                ID3D11UnorderedAccessView* nullUAV[] = {nullptr};
+                m_compositionContext->CSSetUnorderedAccessViews(0, 1, nullUAV, nullptr);
+            }
+        }
+
+        // The region of the content to write into a swapchain image: what changed since the image was last written.
+        // This consumes the dirty region reported by the capture. Everything is damaged when the content was resized or
+        // must be copied again with different parameters.
+        D3D11_BOX GetDamagedRegion(Window& window,
+                                   std::vector<RECT>& damage,
+                                   size_t imageCount,
+                                   int imageIndex,
+                                   const D3D11_BOX& box,
+                                   const ovrSizei& size) {
+            const RECT dirtyRect = window.captureWindow->takeDirtyRect();
+            if (damage.size() != imageCount || window.lastFrameGeneration == 0 ||
+                window.opacity != window.lastOpacity || size.w != window.contentViewport.Size.w ||
+                size.h != window.contentViewport.Size.h) {
+                damage.assign(imageCount, CaptureWindow::EverythingDirty);
+            } else {
+                for (auto& imageDamage : damage) {
+                    UnionRect(&imageDamage, &imageDamage, &dirtyRect);
                 }
+            }
 
-                // Handle billboarding.
-                if (window.isMinimized && window.placement != WindowPlacement::HeadLocked) {
-                    // Minimized window always faces us.
-                    geom::facingCamera(window.quad.QuadPoseCenter, m_lastHeadPose);
-                    geom::alignToGravity(window.quad.QuadPoseCenter);
+            const RECT contentRect{(LONG)box.left, (LONG)box.top, (LONG)box.right, (LONG)box.bottom};
+            RECT rect;
+            IntersectRect(&rect, &damage[imageIndex], &contentRect);
+            damage[imageIndex] = {};
+
+            D3D11_BOX region{};
+            region.left = rect.left;
+            region.top = rect.top;
+            region.right = rect.right;
+            region.bottom = rect.bottom;
+            region.back = 1;
+            return region;
+        }
+
+        // The downscale left to apply when copying the capture surface, which may already be downscaled on the adapter
+        // owning the capture.
+        static uint32_t GetCopyDownscale(const Window& window) {
+            return std::max(window.downscale / window.captureWindow->getSurfaceDownscale(), 1u);
+        }
+
+        // The region of the capture surface with the window content (without the invisible resize borders).
+        D3D11_BOX GetContentBox(const Window& window, uint32_t slot, const D3D11_TEXTURE2D_DESC& windowSurfaceDesc) {
+            D3D11_BOX box{};
+            box.back = 1;
+            if (window.hwnd) {
+                const WindowGeometryCache::Geometry geometry = m_windowGeometry->get(slot);
+                const UINT surfaceDownscale = window.captureWindow->getSurfaceDownscale();
+                const UINT width = ((UINT)geometry.width + surfaceDownscale - 1) / surfaceDownscale;
+                const UINT height = ((UINT)geometry.height + surfaceDownscale - 1) / surfaceDownscale;
+                box.right = std::min(width, windowSurfaceDesc.Width);
+                box.bottom = std::min(height, windowSurfaceDesc.Height);
+            } else {
+                box.right = windowSurfaceDesc.Width;
+                box.bottom = windowSurfaceDesc.Height;
+            }
+            return box;
+        }
+
+        // Get the (cached) shader resource view for a capture surface.
+        ID3D11ShaderResourceView* GetSurfaceView(Window& window,
+                                                 ID3D11Texture2D* windowSurface,
+                                                 const D3D11_TEXTURE2D_DESC& windowSurfaceDesc) {
+            for (const auto& entry : window.surfaceViews) {
+                if (entry.first.Get() == windowSurface) {
+                    return entry.second.Get();
                 }
             }
+
+            // The frame pool may have reallocated its buffers: drop the stale views.
+            if (window.surfaceViews.size() >= CaptureWindow::FramePoolSize) {
+                window.surfaceViews.clear();
+            }
+
+            ComPtr<ID3D11ShaderResourceView> srv;
+            D3D11_SHADER_RESOURCE_VIEW_DESC desc{};
+            desc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
+            desc.Format = windowSurfaceDesc.Format;
+            desc.Texture2D.MipLevels = 1;
+            CHECK_HRCMD(
+                m_compositionDevice->CreateShaderResourceView(windowSurface, &desc, srv.ReleaseAndGetAddressOf()));
+            window.surfaceViews.push_back(std::make_pair(windowSurface, srv));
+
+            return srv.Get();
         }
 
-        // Pull the state from the memory mapped file to create the resources for the window.
-        void OpenWindow(uint32_t slot) {
-            const auto& state = m_overlayState[slot];
+        // Pull the state from the memory mapped file to create the resources for the window. Returns false if the
+        // ShellApp was writing the slot, in which case we must try again on the next frame.
+        bool OpenWindow(uint32_t slot) {
+            shared::OverlayState state;
+            if (!shared::tryRead(m_overlayState[slot], m_overlayState[slot].shellAppSequence, state)) {
+                return false;
+            }
             auto& window = m_windows[slot];
 
             if (!state.isMonitor) {
@@ -1352,33 +4910,51 @@ void main(uint2 pos : SV_DispatchThreadID)
                 window.hwnd = nullptr;
             }
             if (!window.hwnd && !window.monitor) {
-                return;
+                return true;
             }
 
             window.quad.Header.Type = ovrLayerType_Quad;
-            window.captureWindow = window.hwnd
-                                       ? std::make_unique<CaptureWindow>(m_compositionDevice.Get(), window.hwnd)
-                                       : std::make_unique<CaptureWindow>(m_compositionDevice.Get(), window.monitor);
-            window.quad.QuadPoseCenter = {{state.pose.orientation.x,
-                                           state.pose.orientation.y,
-                                           state.pose.orientation.z,
-                                           state.pose.orientation.w},
-                                          {state.pose.position.x, state.pose.position.y, state.pose.position.z}};
-            window.scale = state.scale;
+            m_windowGeometry->track(slot, window.hwnd, window.monitor);
+
+            // Keep the placement from a previous session only if it belongs to this window.
+            const bool isPlaced = state.poseGeneration == state.generation;
+            if (isPlaced) {
+                window.quad.QuadPoseCenter = {{state.pose.orientation.x,
+                                               state.pose.orientation.y,
+                                               state.pose.orientation.z,
+                                               state.pose.orientation.w},
+                                              {state.pose.position.x, state.pose.position.y, state.pose.position.z}};
+                window.scale = state.scale;
+                window.isMinimized = state.isMinimized;
+            } else {
+                window.scale = 1.f;
+                window.isMinimized = false;
+            }
             window.opacity = state.opacity / 100.f;
             window.placement = (WindowPlacement)state.placement;
             window.isInteractable = state.isInteractable;
             window.isFrozen = state.isFrozen;
-            window.isMinimized = state.isMinimized;
-
-            // Swapchain is created lazily.
-            window.swapchainSize = {0, 0};
-            window.swapchain = nullptr;
+            window.isColorKeyed = state.isColorKeyed;
+            window.colorKey = state.colorKey;
+            window.colorKeyTolerance = state.colorKeyTolerance;
+            window.refreshRate = state.refreshRate;
+            window.curvature = GetCurvature(state);
+            window.isSnapshot = state.isSnapshot;
+            window.snapshotRequest = state.snapshotRequest;
+            window.generation = state.generation;
+            window.outputMonitor =
+                window.monitor ? window.monitor : MonitorFromWindow(window.hwnd, MONITOR_DEFAULTTONEAREST);
+            window.hdrColorScale = GetHdrColorScale(window.outputMonitor);
+
+            // The window is displayed once its capture was created in the background.
+            window.stagingId = ++m_lastStagingId;
+            RequestWindowCapture(window, slot);
 
             window.hasFocus = false;
+            m_activeSlots.push_back(slot);
 
             // If the window is new, we spawn it in front of the user.
-            if (OVR::Posef(window.quad.QuadPoseCenter).IsNan()) {
+            if (!isPlaced || OVR::Posef(window.quad.QuadPoseCenter).IsNan()) {
                 OVR::Posef front = OVR::Posef::Pose(OVR::Quatf::Identity(), {0.f, 0.f, -SpawningDistance});
 
                 switch (window.placement) {
@@ -1396,41 +4972,100 @@ void main(uint2 pos : SV_DispatchThreadID)
                     break;
                 }
             }
+
+            return true;
         }
 
-        // Synchronize state with the memory mapped file.
+        // Synchronize state with the memory mapped file. This never waits for the ShellApp.
         void SyncWindow(uint32_t slot) {
-            auto& state = m_overlayState[slot];
+            auto& sharedState = m_overlayState[slot];
             auto& window = m_windows[slot];
 
-            // Push.
-            state.pose = {{window.quad.QuadPoseCenter.Orientation.x,
-                           window.quad.QuadPoseCenter.Orientation.y,
-                           window.quad.QuadPoseCenter.Orientation.z,
-                           window.quad.QuadPoseCenter.Orientation.w},
-                          {window.quad.QuadPoseCenter.Position.x,
-                           window.quad.QuadPoseCenter.Position.y,
-                           window.quad.QuadPoseCenter.Position.z}};
-            state.scale = window.scale;
-            state.isMinimized = window.isMinimized;
-
-            // Pull.
-            window.opacity = state.opacity / 100.f;
+            // Push. We are the only writer of these fields. Should the ShellApp reassign the slot meanwhile, the stale
+            // generation tells the reopened window to ignore them.
+            shared::beginWrite(sharedState.ovrlaySequence);
+            sharedState.pose = {{window.quad.QuadPoseCenter.Orientation.x,
+                                 window.quad.QuadPoseCenter.Orientation.y,
+                                 window.quad.QuadPoseCenter.Orientation.z,
+                                 window.quad.QuadPoseCenter.Orientation.w},
+                                {window.quad.QuadPoseCenter.Position.x,
+                                 window.quad.QuadPoseCenter.Position.y,
+                                 window.quad.QuadPoseCenter.Position.z}};
+            sharedState.scale = window.scale;
+            sharedState.isMinimized = window.isMinimized;
+            sharedState.poseGeneration = window.generation;
+            shared::endWrite(sharedState.ovrlaySequence);
+
+            // Pull. If the ShellApp is in the middle of an update, keep the current state until the next frame.
+            if (!m_isStateChanged) {
+                return;
+            }
+            shared::OverlayState state;
+            if (!shared::tryRead(sharedState, sharedState.shellAppSequence, state)) {
+                m_isStateSyncPending = true;
+                return;
+            }
+            // The slot was reassigned by the ShellApp: the window is reopened on the next frame.
+            if (state.generation != window.generation) {
+                return;
+            }
+            if (window.opacity != state.opacity / 100.f) {
+                window.opacity = state.opacity / 100.f;
+                m_wakeCompositionThread = true;
+            }
             window.placement = (WindowPlacement)state.placement;
             window.isInteractable = state.isInteractable;
             window.isFrozen = state.isFrozen;
+            if (window.isColorKeyed != !!state.isColorKeyed || window.colorKey != state.colorKey ||
+                window.colorKeyTolerance != state.colorKeyTolerance) {
+                window.isColorKeyed = state.isColorKeyed;
+                window.colorKey = state.colorKey;
+                window.colorKeyTolerance = state.colorKeyTolerance;
+
+                // Force a copy with the new color key.
+                window.lastFrameGeneration = 0;
+                m_wakeCompositionThread = true;
+            }
+            if (window.refreshRate != state.refreshRate) {
+                window.refreshRate = state.refreshRate;
+                window.nextUpdateTime = 0;
+                ApplyWindowUpdateInterval(window);
+            }
+            window.curvature = GetCurvature(state);
+            window.isSnapshot = state.isSnapshot;
+            if (window.snapshotRequest != state.snapshotRequest) {
+                window.snapshotRequest = state.snapshotRequest;
+                window.isSnapshotRequested = true;
+            }
+        }
+
+        static float GetCurvature(const shared::OverlayState& state) {
+            return std::min(state.curvature * (float)MATH_DOUBLE_TWOPI / 360, MaxCurvature);
         }
 
         // Cleanup all resources associated with a window.
         void CloseWindow(uint32_t slot) {
             auto& window = m_windows[slot];
 
+            // Keep the swapchains around, in case another window has a similar size.
+            ReleaseSwapchain(window.swapchain);
+            ReleaseSwapchain(window.retiredSwapchain);
+            FreeAtlasRect(window);
             window.Clear();
+            m_windowGeometry->untrack(slot);
+
+            // Order does not matter in the dense list.
+            const auto it = std::find(m_activeSlots.begin(), m_activeSlots.end(), slot);
+            if (it != m_activeSlots.end()) {
+                *it = m_activeSlots.back();
+                m_activeSlots.pop_back();
+            }
         }
 
         // Resources for rendering.
         ovrSession m_ovrSession{nullptr};
         ovrDispatchTable m_dispatchTable{};
+        decltype(ovr_GetHmdDesc)* m_getHmdDesc{nullptr};
         ComPtr<ID3D11Device5> m_submissionDevice;
         ComPtr<ID3D11DeviceContext4> m_submissionContext;
         ComPtr<ID3D11Device5> m_compositionDevice;
@@ -1438,27 +5073,141 @@ void main(uint2 pos : SV_DispatchThreadID)
         ComPtr<ID3D11Fence> m_fenceOnSubmissionDevice;
         ComPtr<ID3D11Fence> m_fenceOnCompositionDevice;
         uint64_t m_submissionFenceValue{0};
+        uint64_t m_lastWaitedFenceValue{0};
+
+        // Asynchronous composition.
+        bool m_useAsyncComposition{false};
+        bool m_useAdaptiveResolution{false};
+        bool m_useDirectCapture{false};
+        bool m_useCrossAdapterCapture{false};
+        std::thread m_compositionThread;
+        std::atomic<bool> m_isCompositionThreadFailed{false};
+        std::mutex m_compositionMutex;
+        // The copies prepared by PrepareWindowsContent(), and the swapchains they write into. The swapchains are not
+        // handed out by the pool until the copies were recorded.
+        std::vector<QueuedCopy> m_queuedCopies;
+        std::vector<ovrTextureSwapChain> m_composingSwapchains;
+        wil::unique_event m_frameArrivedEvent;
+        wil::unique_event m_stopCompositionEvent;
+        bool m_wakeCompositionThread{false};
+
+        // Background creation of resources.
+        std::thread m_stagingThread;
+        std::mutex m_stagingMutex;
+        wil::unique_event m_stagingEvent;
+        wil::unique_event m_stopStagingEvent;
+        std::vector<StagingWork> m_stagingRequests;
+        std::vector<StagingWork> m_stagingResults;
+        std::vector<StagingWork> m_collectedResults;
+        uint64_t m_lastStagingId{0};
+
+        // The captures kept from the previous session, until the windows are reopened.
+        struct RetainedCapture {
+            HWND hwnd{nullptr};
+            HMONITOR monitor{nullptr};
+            DXGI_FORMAT captureFormat{DXGI_FORMAT_UNKNOWN};
+            std::unique_ptr<CaptureWindow> captureWindow;
+        };
+        std::vector<RetainedCapture> m_retainedCaptures;
+
+        // Unused swapchains, oldest first.
+        std::vector<WindowSwapchain> m_swapchainPool;
+        bool m_canStageSwapchains{true};
+        bool m_canDirectCapture{false};
+
+        // Capture formats.
+        bool m_canWriteBgra{false};
+        std::vector<std::pair<HMONITOR, float>> m_hdrOutputs;
+
+        // The devices of the other adapters driving captured monitors. Only accessed from the staging thread, while
+        // it is running.
+        struct OwningAdapterDevice {
+            LUID luid{};
+            ComPtr<ID3D11Device5> device;
+            ComPtr<ID3D11DeviceContext4> context;
+            ComPtr<ID3D11ComputeShader> downscaleShader;
+        };
+        LUID m_compositionAdapterLuid{};
+        std::vector<OwningAdapterDevice> m_owningAdapters;
+
+        std::array<GpuTimer, GpuTimerLatency> m_gpuTimers;
+        uint32_t m_gpuTimerIndex{0};
+        std::array<GpuTimer, GpuTimerLatency> m_directGpuTimers;
+        uint32_t m_directGpuTimerIndex{0};
+
+        // The atlas shared by the small windows. Only the composition thread writes it, and it is committed at most
+        // once per frame.
+        bool m_useAtlas{false};
+        WindowSwapchain m_atlas;
+        std::unique_ptr<AtlasAllocator> m_atlasAllocator;
+        bool m_isAtlasDirty{false};
+        uint64_t m_atlasReadyFenceValue{0};
+
+        // The time between two snapshots (QPC time, 0 for only on request).
+        int64_t m_snapshotInterval{0};
+
+        // Culling.
+        ovrFovPort m_cullingFov{DefaultFovTan, DefaultFovTan, DefaultFovTan, DefaultFovTan};
+        bool m_useOcclusionCulling{false};
+
+        // Refresh rates and GPU budget (in microseconds per frame, 0 for none).
+        DWORD m_gpuBudget{0};
+        float m_gpuTimeSinceGpuBudgetCheck{0.f};
+        uint32_t m_framesSinceGpuBudgetCheck{0};
+        int64_t m_lastUpdateTime{0};
+        double m_frameTime{0.0};
 
         ComPtr<ID3D11ComputeShader> m_transparencyShader;
+        ComPtr<ID3D11ComputeShader> m_colorKeyTransparencyShader;
+        ComPtr<ID3D11ComputeShader> m_downscaleShader;
         ComPtr<ID3D11Buffer> m_transparencyConstants;
         ovrTextureSwapChain m_cursorSwapchain{nullptr};
 
         // State sharing.
         wil::unique_handle m_overlayStateFile;
+        shared::OverlayStateHeader* m_overlayStateHeader{nullptr};
         shared::OverlayState* m_overlayState{nullptr};
+        uint32_t m_capacity{0};
+        std::unique_ptr<WindowGeometryCache> m_windowGeometry;
+        wil::unique_handle m_overlayStatsFile;
+        shared::OverlayStats* m_overlayStats{nullptr};
+
+        // Statistics.
+        double m_qpcFrequency{1.0};
+        uint64_t m_frameCount{0};
+        RollingStatistics m_sortWindowsStats;
+        RollingStatistics m_handleInteractionsStats;
+        RollingStatistics m_updateWindowsStats;
+        std::vector<RollingStatistics> m_gpuTimeStats;
 
         // Frame/layers state.
-        std::array<Window, shared::OverlayCount> m_windows;
+        std::unique_ptr<Window[]> m_windows;
+        // The slots with an open window, and the slots the ShellApp reported as occupied when they were opened.
+        std::vector<uint32_t> m_activeSlots;
+        uint64_t m_openedSlots{0};
+        // The last change counter seen from the ShellApp. A pending sync forces another look at the slots, after a
+        // torn read or when all windows were reset.
+        uint32_t m_lastChangeCount{0};
+        bool m_isStateChanged{false};
+        bool m_isStateSyncPending{true};
         std::vector<uint32_t> m_sortedWindows;
+        std::vector<std::pair<float, uint32_t>> m_sortedWindowsDistances;
         ovrLayerQuad m_cursorQuad{};
 
         // Interactions state.
         OVR::Posef m_lastHeadPose{OVR::Posef::Identity()};
         uint32_t m_lastSideToInteract{0};
+        std::unique_ptr<InputInjector> m_inputInjector;
+        ovrInputState m_inputState{};
+        // The windows that each hand may be aiming at, for world-locked and head-locked windows, per sorted window.
+        geom::HitPlanes m_hitPlanes;
+        std::vector<uint8_t> m_hitCandidates[2][2];
         OVR::Posef m_lastControllerPoses[2]{OVR::Posef::Identity(), OVR::Posef::Identity()};
         std::optional<ovrPosef> m_cursorPose{};
         OVR::Vector3f m_lastCursorPosition{};
         uint32_t m_windowHovered{};
+        // Whether the cursor is moved with a new sample of the hand pose right before submission.
+        bool m_useLateLatching{false};
 
         bool m_isMenuPressed{false};
         bool m_isPrimaryPressed{false};
@@ -1476,9 +5225,9 @@ void main(uint2 pos : SV_DispatchThreadID)
                 CreateDirectoryW(programData.wstring().c_str(), nullptr);
 
                 // Start logging to file.
-                if (!s_logStream.is_open()) {
-                    std::wstring logFile = (programData / ("OVRlay.log")).wstring();
-                    s_logStream.open(logFile, std::ios_base::ate);
+                if (!s_logger.isOpen()) {
+                    s_logger.setLevel((LogLevel)getSetting(L"log_level", (DWORD)LogLevel::Info));
+                    s_logger.open(programData / "OVRlay.log");
                 }
 
                 Log("Starting up...\n");
@@ -1495,16 +5244,29 @@ namespace OVRlay {
 #endif
 
     void Initialize(ovrSession session, const ovrDispatchTable& dispatchTable, ID3D11Device* ovrDevice) {
-        OverlayManager::GetInstance()->SetSubmissionSession(session, dispatchTable, ovrDevice);
+        const ovrDispatchTable2 dispatchTable2{sizeof(ovrDispatchTable2)};
+        OverlayManager::GetInstance()->SetSubmissionSession(session, dispatchTable, dispatchTable2, ovrDevice);
+    }
+
+    void Initialize2(ovrSession session,
+                     const ovrDispatchTable& dispatchTable,
+                     const ovrDispatchTable2& dispatchTable2,
+                     ID3D11Device* ovrDevice) {
+        OverlayManager::GetInstance()->SetSubmissionSession(session, dispatchTable, dispatchTable2, ovrDevice);
     }
 
     void GetLayers(double ovrTime, std::vector<const ovrLayerHeader*>& layers) {
         OverlayManager::GetInstance()->Update(ovrTime);
-        OverlayManager::GetInstance()->GetLayers(layers);
+        OverlayManager::GetInstance()->GetLayers(ovrTime, layers);
     }
 
     void GetLayers2(double ovrTime, std::vector<ovrLayer_Union>& layers) {
-        std::vector<const ovrLayerHeader*> layersPtr;
+        // Reuse the list of layers across frames to avoid allocations.
+        thread_local std::vector<const ovrLayerHeader*> layersPtr;
+        if (!layersPtr.capacity()) {
+            layersPtr.reserve(ovrMaxLayerCount);
+        }
+        layersPtr.clear();
         GetLayers(ovrTime, layersPtr);
         for (auto& layer : layersPtr) {
             ovrLayer_Union u{};
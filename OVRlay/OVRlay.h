@@ -27,6 +27,10 @@
 #include <OVR_CAPI_D3D.h>
 #include <vector>
 
+// With OVRLAY_STANDALONE, OVRlay.cpp is compiled into another project (like OVRlayBench) instead of the DLL. That
+// project must also compile the TransparencyShader*.hlsl files with FxCompile (compute shaders, model 5.0, entry point
+// main) into headers (HeaderFileOutput "$(IntDir)%(Filename).h", VariableName "g_%(Filename)"), and add $(IntDir) to
+// its include path. See OVRlayBench.vcxproj.
 #if defined(OVRLAY_STANDALONE)
 namespace OVRlay {
 #define OVRLAY_DLLAPI
@@ -51,7 +55,18 @@ extern "C" {
         decltype(ovr_SetControllerVibration)* ovr_SetControllerVibration;
     };
 
+    // Optional entry points, passed to Initialize2(). The size must be set to sizeof(ovrDispatchTable2) as seen by
+    // the caller: the entry points past that size are treated as null, so that fields can be added to the end.
+    struct ovrDispatchTable2 {
+        size_t size;
+        decltype(ovr_GetHmdDesc)* ovr_GetHmdDesc;
+    };
+
     void OVRLAY_DLLAPI Initialize(ovrSession session, const ovrDispatchTable& dispatchTable, ID3D11Device* ovrDevice);
+    void OVRLAY_DLLAPI Initialize2(ovrSession session,
+                                   const ovrDispatchTable& dispatchTable,
+                                   const ovrDispatchTable2& dispatchTable2,
+                                   ID3D11Device* ovrDevice);
     void OVRLAY_DLLAPI GetLayers(double ovrTime, std::vector<const ovrLayerHeader*>& layers);
     void OVRLAY_DLLAPI GetLayers2(double ovrTime, std::vector<ovrLayer_Union>& layers);
     bool OVRLAY_DLLAPI HasFocus();
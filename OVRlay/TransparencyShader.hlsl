@@ -0,0 +1,15 @@
+#include "TransparencyShader.hlsli"
+
+// Constant alpha for the entire window.
+[numthreads(8, 8, 1)]
+void main(uint2 id : SV_DispatchThreadID)
+{
+    const uint2 pos = id + Offset;
+    if (any(pos >= Size)) {
+        return;
+    }
+
+    // Make sure to premultiply RGB by alpha.
+    const float3 rgb = in_texture[pos].rgb * ColorScale;
+    out_texture[pos + DestOffset] = float4(rgb * Alpha, Alpha);
+}
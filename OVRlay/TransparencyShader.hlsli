@@ -0,0 +1,14 @@
+// Shared by the transparency shaders. Must match TransparencyShaderConstants.
+cbuffer config : register(b0) {
+    float3 TransparentColor;
+    float Alpha;
+    uint2 Size;
+    float Tolerance;
+    uint Downscale;
+    float ColorScale;
+    uint2 Offset;
+    uint2 DestOffset;
+    uint2 SourceSize;
+};
+Texture2D in_texture : register(t0);
+RWTexture2D<float4> out_texture : register(u0);
@@ -0,0 +1,16 @@
+#include "TransparencyShader.hlsli"
+
+// Pixels matching the transparent color are keyed out, the others get the constant alpha.
+[numthreads(8, 8, 1)]
+void main(uint2 id : SV_DispatchThreadID)
+{
+    const uint2 pos = id + Offset;
+    if (any(pos >= Size)) {
+        return;
+    }
+
+    // Make sure to premultiply RGB by alpha.
+    const float3 rgb = in_texture[pos].rgb * ColorScale;
+    const float a = all(abs(rgb - TransparentColor) <= Tolerance) ? 0.f : Alpha;
+    out_texture[pos + DestOffset] = float4(rgb * a, a);
+}
@@ -0,0 +1,27 @@
+#include "TransparencyShader.hlsli"
+
+// Box filter over Downscale x Downscale source pixels, with the same transparency as the other shaders.
+[numthreads(8, 8, 1)]
+void main(uint2 id : SV_DispatchThreadID)
+{
+    const uint2 pos = id + Offset;
+    if (any(pos >= Size)) {
+        return;
+    }
+
+    // Average the premultiplied colors to avoid fringes around keyed out pixels. The blocks on the right and bottom
+    // edges may be partial: only average the pixels within the source content.
+    float4 color = 0;
+    const uint2 origin = pos * Downscale;
+    const uint2 end = min(origin + Downscale, SourceSize);
+    for (uint y = origin.y; y < end.y; y++) {
+        for (uint x = origin.x; x < end.x; x++) {
+            const float3 rgb = in_texture[uint2(x, y)].rgb * ColorScale;
+            const float a =
+                (TransparentColor.x >= 0.f && all(abs(rgb - TransparentColor) <= Tolerance)) ? 0.f : Alpha;
+            color += float4(rgb * a, a);
+        }
+    }
+    const uint2 count = end - origin;
+    out_texture[pos + DestOffset] = color / (count.x * count.y);
+}
@@ -51,6 +51,7 @@ namespace {
     ovrSession g_ovrSession{nullptr};
     ID3D11Device* g_ovrDevice{nullptr};
     ovrDispatchTable g_dispatchTable{};
+    ovrDispatchTable2 g_dispatchTable2{sizeof(ovrDispatchTable2)};
     decltype(ovr_GetPredictedDisplayTime)* g_GetPredictedDisplayTime{nullptr};
 
     decltype(ovr_CreateTextureSwapChainDX)* g_original_CreateTextureSwapChainDX{nullptr};
@@ -70,7 +71,7 @@ namespace {
 
         // (Re)Initialize OVRlay.
         if (session && session != g_ovrSession && d3dDevice && d3dDevice.Get() != g_ovrDevice) {
-            Initialize(session, g_dispatchTable, d3dDevice.Get());
+            Initialize2(session, g_dispatchTable, g_dispatchTable2, d3dDevice.Get());
             g_ovrSession = session;
             g_ovrDevice = d3dDevice.Get();
         }
@@ -101,13 +102,23 @@ namespace {
         return result;
     }
 
+    // Reuse the list of layers across frames to avoid allocations.
+    std::vector<const ovrLayerHeader*>& GetLayersScratch() {
+        thread_local std::vector<const ovrLayerHeader*> layers;
+        if (!layers.capacity()) {
+            layers.reserve(ovrMaxLayerCount);
+        }
+        return layers;
+    }
+
     decltype(ovr_EndFrame)* g_original_EndFrame{nullptr};
     ovrResult __cdecl hook_EndFrame(ovrSession session,
                                     long long frameIndex,
                                     const ovrViewScaleDesc* viewScaleDesc,
                                     ovrLayerHeader const* const* layerPtrList,
                                     unsigned int layerCount) {
-        std::vector<const ovrLayerHeader*> layers(layerPtrList, layerPtrList + layerCount);
+        std::vector<const ovrLayerHeader*>& layers = GetLayersScratch();
+        layers.assign(layerPtrList, layerPtrList + layerCount);
 
         if (g_ovrSession) {
             // Append the overlays.
@@ -123,7 +134,8 @@ namespace {
                                        const ovrViewScaleDesc* viewScaleDesc,
                                        ovrLayerHeader const* const* layerPtrList,
                                        unsigned int layerCount) {
-        std::vector<const ovrLayerHeader*> layers(layerPtrList, layerPtrList + layerCount);
+        std::vector<const ovrLayerHeader*>& layers = GetLayersScratch();
+        layers.assign(layerPtrList, layerPtrList + layerCount);
 
         if (g_ovrSession) {
             // Append the overlays.
@@ -176,6 +188,7 @@ namespace {
         g_dispatchTable.ovr_GetTrackingState = GET_OVR_PROC_ADDRESS(ovr_GetTrackingState);
         g_dispatchTable.ovr_GetInputState = g_original_GetInputState;
         g_dispatchTable.ovr_SetControllerVibration = GET_OVR_PROC_ADDRESS(ovr_SetControllerVibration);
+        g_dispatchTable2.ovr_GetHmdDesc = GET_OVR_PROC_ADDRESS(ovr_GetHmdDesc);
 #undef GET_OVR_PROC_ADDRESS
     }
 
@@ -0,0 +1,608 @@
+// MIT License
+//
+// Copyright(c) 2022-2023 Matthieu Bucchianeri
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this softwareand associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright noticeand this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// A benchmark and soak test for OVRlay, without a headset or a game. OVRlay is built in standalone mode against a mock
+// LibOVR, and plays the role of the ShellApp for a set of test windows (or monitors).
+//
+// Usage: OVRlayBench [--windows N] [--monitors N] [--width W] [--height H] [--opacity 0-100] [--content-rate HZ]
+//                    [--refresh-rate HZ] [--curvature DEGREES] [--fps HZ] [--duration SECONDS] [--interactable]
+//
+// The registry settings of OVRlay apply as usual.
+
+#define OVRLAY_STANDALONE
+
+// Build OVRlay in this translation unit, so we can use its shared memory layout and utilities.
+#include "../OVRlay/OVRlay.cpp"
+
+#include <cstdio>
+#include <limits>
+#include <new>
+
+#pragma region "Allocation counters"
+namespace {
+    std::atomic<uint64_t> g_allocationCount{0};
+    thread_local uint64_t t_allocationCount{0};
+} // namespace
+
+void* operator new(size_t size) {
+    g_allocationCount.fetch_add(1, std::memory_order_relaxed);
+    t_allocationCount++;
+    if (void* ptr = malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete[](void* ptr) noexcept {
+    free(ptr);
+}
+#pragma endregion
+
+namespace {
+
+    struct Options {
+        uint32_t windowCount{4};
+        uint32_t monitorCount{0};
+        int width{800};
+        int height{600};
+        uint32_t opacity{100};
+        uint32_t contentRate{60};
+        uint32_t refreshRate{0};
+        uint32_t curvature{0};
+        uint32_t fps{90};
+        uint32_t duration{10};
+        bool isInteractable{false};
+    };
+
+#pragma region "Mock LibOVR"
+    namespace mock {
+
+        // Any non-null value will do.
+        const ovrSession Session = reinterpret_cast<ovrSession>(static_cast<uintptr_t>(1));
+
+        struct Swapchain {
+            std::vector<ComPtr<ID3D11Texture2D>> images;
+            int currentIndex{0};
+        };
+
+        ID3D11Device* g_device = nullptr;
+        LARGE_INTEGER g_startTime{};
+        double g_qpcFrequency = 1.0;
+        // Swapchains may be created and destroyed by the OVRlay threads.
+        std::atomic<uint32_t> g_swapchainCount{0};
+        std::atomic<uint64_t> g_commitCount{0};
+
+        DXGI_FORMAT toTypelessFormat(ovrTextureFormat format) {
+            switch (format) {
+            case OVR_FORMAT_R8G8B8A8_UNORM:
+            case OVR_FORMAT_R8G8B8A8_UNORM_SRGB:
+                return DXGI_FORMAT_R8G8B8A8_TYPELESS;
+            case OVR_FORMAT_B8G8R8A8_UNORM:
+            case OVR_FORMAT_B8G8R8A8_UNORM_SRGB:
+                return DXGI_FORMAT_B8G8R8A8_TYPELESS;
+            case OVR_FORMAT_B8G8R8X8_UNORM:
+            case OVR_FORMAT_B8G8R8X8_UNORM_SRGB:
+                return DXGI_FORMAT_B8G8R8X8_TYPELESS;
+            case OVR_FORMAT_R16G16B16A16_FLOAT:
+                return DXGI_FORMAT_R16G16B16A16_TYPELESS;
+            default:
+                return DXGI_FORMAT_UNKNOWN;
+            }
+        }
+
+        double ovr_GetTimeInSeconds() {
+            LARGE_INTEGER now;
+            QueryPerformanceCounter(&now);
+            return (now.QuadPart - g_startTime.QuadPart) / g_qpcFrequency;
+        }
+
+        ovrResult ovr_CreateTextureSwapChainDX(ovrSession session,
+                                               IUnknown* d3dPtr,
+                                               const ovrTextureSwapChainDesc* desc,
+                                               ovrTextureSwapChain* outTextureSet) {
+            D3D11_TEXTURE2D_DESC textureDesc{};
+            textureDesc.Format = toTypelessFormat(desc->Format);
+            textureDesc.Width = desc->Width;
+            textureDesc.Height = desc->Height;
+            textureDesc.ArraySize = textureDesc.MipLevels = textureDesc.SampleDesc.Count = 1;
+            textureDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_RENDER_TARGET;
+            if (desc->BindFlags & ovrTextureBind_DX_UnorderedAccess) {
+                textureDesc.BindFlags |= D3D11_BIND_UNORDERED_ACCESS;
+            }
+            // Like the runtime, share the images so they can be opened on another device.
+            textureDesc.MiscFlags = D3D11_RESOURCE_MISC_SHARED;
+            if (textureDesc.Format == DXGI_FORMAT_UNKNOWN) {
+                return ovrError_InvalidParameter;
+            }
+
+            ComPtr<ID3D11Device> device;
+            if (FAILED(d3dPtr->QueryInterface(IID_PPV_ARGS(device.ReleaseAndGetAddressOf())))) {
+                return ovrError_InvalidParameter;
+            }
+
+            auto swapchain = std::make_unique<Swapchain>();
+            for (int i = 0; i < (desc->StaticImage ? 1 : 3); i++) {
+                ComPtr<ID3D11Texture2D> texture;
+                if (FAILED(device->CreateTexture2D(&textureDesc, nullptr, texture.ReleaseAndGetAddressOf()))) {
+                    return ovrError_MemoryAllocationFailure;
+                }
+                swapchain->images.push_back(texture);
+            }
+
+            *outTextureSet = reinterpret_cast<ovrTextureSwapChain>(swapchain.release());
+            g_swapchainCount++;
+            return ovrSuccess;
+        }
+
+        void ovr_DestroyTextureSwapChain(ovrSession session, ovrTextureSwapChain chain) {
+            if (chain) {
+                delete reinterpret_cast<Swapchain*>(chain);
+                g_swapchainCount--;
+            }
+        }
+
+        ovrResult ovr_GetTextureSwapChainLength(ovrSession session, ovrTextureSwapChain chain, int* outLength) {
+            *outLength = (int)reinterpret_cast<Swapchain*>(chain)->images.size();
+            return ovrSuccess;
+        }
+
+        ovrResult ovr_GetTextureSwapChainCurrentIndex(ovrSession session, ovrTextureSwapChain chain, int* outIndex) {
+            *outIndex = reinterpret_cast<Swapchain*>(chain)->currentIndex;
+            return ovrSuccess;
+        }
+
+        ovrResult ovr_GetTextureSwapChainBufferDX(
+            ovrSession session, ovrTextureSwapChain chain, int index, IID iid, void** outBuffer) {
+            auto swapchain = reinterpret_cast<Swapchain*>(chain);
+            if (index < 0 || index >= (int)swapchain->images.size()) {
+                return ovrError_InvalidParameter;
+            }
+            return SUCCEEDED(swapchain->images[index]->QueryInterface(iid, outBuffer)) ? ovrSuccess
+                                                                                        : ovrError_InvalidParameter;
+        }
+
+        ovrResult ovr_CommitTextureSwapChain(ovrSession session, ovrTextureSwapChain chain) {
+            auto swapchain = reinterpret_cast<Swapchain*>(chain);
+            swapchain->currentIndex = (swapchain->currentIndex + 1) % (int)swapchain->images.size();
+            g_commitCount++;
+            return ovrSuccess;
+        }
+
+        // The head looks around slowly, and both hands sweep across the overlays in front of it.
+        ovrTrackingState ovr_GetTrackingState(ovrSession session, double absTime, ovrBool latencyMarker) {
+            ovrTrackingState state{};
+            state.StatusFlags = ovrStatus_OrientationTracked | ovrStatus_PositionTracked;
+            state.HeadPose.ThePose = OVR::Posef(
+                OVR::Quatf(OVR::Vector3f(0, 1, 0), 0.2f * (float)std::sin(absTime * 0.5)), OVR::Vector3f(0, 1.6f, 0));
+            for (uint32_t side = 0; side < 2; side++) {
+                const float phase = (float)absTime * 1.5f + side * (float)MATH_DOUBLE_PI;
+                state.HandPoses[side].ThePose =
+                    OVR::Posef(OVR::Quatf(OVR::Vector3f(0, 1, 0), 0.6f * std::sin(phase)) *
+                                   OVR::Quatf(OVR::Vector3f(1, 0, 0), 0.2f * std::cos(phase * 0.7f)),
+                               OVR::Vector3f(side ? 0.2f : -0.2f, 1.3f, -0.3f));
+                state.HandStatusFlags[side] = ovrStatus_OrientationValid | ovrStatus_PositionValid;
+            }
+            return state;
+        }
+
+        // No buttons pressed: the overlays are hit tested, but no input is ever injected into the desktop.
+        ovrResult ovr_GetInputState(ovrSession session, ovrControllerType controllerType, ovrInputState* inputState) {
+            *inputState = {};
+            inputState->ControllerType = controllerType;
+            return ovrSuccess;
+        }
+
+        ovrResult ovr_SetControllerVibration(ovrSession session,
+                                             ovrControllerType controllerType,
+                                             float frequency,
+                                             float amplitude) {
+            return ovrSuccess;
+        }
+
+        ovrHmdDesc ovr_GetHmdDesc(ovrSession session) {
+            ovrHmdDesc desc{};
+            desc.Type = ovrHmd_CV1;
+            desc.Resolution = {3664, 1920};
+            for (uint32_t eye = 0; eye < ovrEye_Count; eye++) {
+                desc.DefaultEyeFov[eye] = {1.3f, 1.3f, eye ? 0.9f : 1.3f, eye ? 1.3f : 0.9f};
+                desc.MaxEyeFov[eye] = desc.DefaultEyeFov[eye];
+            }
+            return desc;
+        }
+
+        OVRlay::ovrDispatchTable GetDispatchTable() {
+            LARGE_INTEGER frequency;
+            QueryPerformanceFrequency(&frequency);
+            g_qpcFrequency = (double)frequency.QuadPart;
+            QueryPerformanceCounter(&g_startTime);
+
+            OVRlay::ovrDispatchTable table{};
+            table.ovr_GetTimeInSeconds = ovr_GetTimeInSeconds;
+            table.ovr_CreateTextureSwapChainDX = ovr_CreateTextureSwapChainDX;
+            table.ovr_DestroyTextureSwapChain = ovr_DestroyTextureSwapChain;
+            table.ovr_GetTextureSwapChainLength = ovr_GetTextureSwapChainLength;
+            table.ovr_GetTextureSwapChainCurrentIndex = ovr_GetTextureSwapChainCurrentIndex;
+            table.ovr_GetTextureSwapChainBufferDX = ovr_GetTextureSwapChainBufferDX;
+            table.ovr_CommitTextureSwapChain = ovr_CommitTextureSwapChain;
+            table.ovr_GetTrackingState = ovr_GetTrackingState;
+            table.ovr_GetInputState = ovr_GetInputState;
+            table.ovr_SetControllerVibration = ovr_SetControllerVibration;
+            return table;
+        }
+
+        OVRlay::ovrDispatchTable2 GetDispatchTable2() {
+            OVRlay::ovrDispatchTable2 table{sizeof(OVRlay::ovrDispatchTable2)};
+            table.ovr_GetHmdDesc = ovr_GetHmdDesc;
+            return table;
+        }
+
+    } // namespace mock
+#pragma endregion
+
+#pragma region "Test windows"
+    // Top-level windows, repainted at a fixed rate with a moving bar, so that only part of the content changes.
+    class TestWindows {
+      public:
+        TestWindows(const Options& options) : m_options(options) {
+            m_threadReady.create(wil::EventOptions::ManualReset);
+            m_thread = std::thread([this]() { windowThread(); });
+            m_threadReady.wait();
+        }
+
+        ~TestWindows() {
+            PostThreadMessage(m_threadId, WM_QUIT, 0, 0);
+            m_thread.join();
+        }
+
+        const std::vector<HWND>& getWindows() const {
+            return m_windows;
+        }
+
+      private:
+        static LRESULT CALLBACK windowProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
+            switch (msg) {
+            case WM_TIMER:
+                SetWindowLongPtr(hwnd, GWLP_USERDATA, GetWindowLongPtr(hwnd, GWLP_USERDATA) + 1);
+                InvalidateRect(hwnd, nullptr, false);
+                return 0;
+
+            case WM_PAINT: {
+                PAINTSTRUCT ps;
+                const HDC dc = BeginPaint(hwnd, &ps);
+                RECT rect;
+                GetClientRect(hwnd, &rect);
+                const LONG_PTR frame = GetWindowLongPtr(hwnd, GWLP_USERDATA);
+
+                const HBRUSH background = CreateSolidBrush(RGB(32, 32, 48));
+                FillRect(dc, &rect, background);
+                DeleteObject(background);
+
+                const LONG barWidth = std::max(rect.right / 10, 1L);
+                RECT bar = rect;
+                bar.left = (LONG)((frame * 4) % std::max(rect.right - barWidth, 1L));
+                bar.right = bar.left + barWidth;
+                const HBRUSH foreground = CreateSolidBrush(RGB(frame % 256, 128, 255 - frame % 256));
+                FillRect(dc, &bar, foreground);
+                DeleteObject(foreground);
+
+                EndPaint(hwnd, &ps);
+                return 0;
+            }
+            }
+            return DefWindowProc(hwnd, msg, wParam, lParam);
+        }
+
+        void windowThread() {
+            m_threadId = GetCurrentThreadId();
+
+            WNDCLASSEX wc{};
+            wc.cbSize = sizeof(wc);
+            wc.lpfnWndProc = windowProc;
+            wc.hInstance = GetModuleHandle(nullptr);
+            wc.hCursor = LoadCursor(nullptr, IDC_ARROW);
+            wc.lpszClassName = L"OVRlayBench";
+            RegisterClassEx(&wc);
+
+            for (uint32_t i = 0; i < m_options.windowCount; i++) {
+                const std::wstring title = L"OVRlayBench " + std::to_wstring(i);
+                const HWND hwnd = CreateWindowEx(WS_EX_TOOLWINDOW,
+                                                 wc.lpszClassName,
+                                                 title.c_str(),
+                                                 WS_POPUP | WS_VISIBLE,
+                                                 20 + 20 * i,
+                                                 20 + 20 * i,
+                                                 m_options.width,
+                                                 m_options.height,
+                                                 nullptr,
+                                                 nullptr,
+                                                 wc.hInstance,
+                                                 nullptr);
+                if (m_options.contentRate) {
+                    SetTimer(hwnd, 1, std::max(1000 / m_options.contentRate, 1u), nullptr);
+                }
+                m_windows.push_back(hwnd);
+            }
+            m_threadReady.SetEvent();
+
+            MSG msg;
+            while (GetMessage(&msg, nullptr, 0, 0)) {
+                TranslateMessage(&msg);
+                DispatchMessage(&msg);
+            }
+
+            for (HWND hwnd : m_windows) {
+                DestroyWindow(hwnd);
+            }
+        }
+
+        const Options m_options;
+        std::vector<HWND> m_windows;
+        std::thread m_thread;
+        DWORD m_threadId{0};
+        wil::unique_event m_threadReady;
+    };
+#pragma endregion
+
+#pragma region "Overlay state"
+    // Plays the role of the ShellApp: owns the memory mapped file, and imports the test windows.
+    class OverlayStateWriter {
+      public:
+        static constexpr uint32_t Capacity = shared::MaxOverlayCount;
+
+        OverlayStateWriter() {
+            const size_t size = sizeof(shared::OverlayStateHeader) + Capacity * sizeof(shared::OverlayState);
+            *m_file.put() = CreateFileMapping(
+                INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, (DWORD)size, L"OVRlay.OverlayState");
+            if (!m_file || GetLastError() == ERROR_ALREADY_EXISTS) {
+                throw std::runtime_error("Failed to create the memory-mapped file. Make sure the ShellApp is closed.");
+            }
+            m_header = reinterpret_cast<shared::OverlayStateHeader*>(
+                MapViewOfFile(m_file.get(), FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, size));
+            m_overlays = reinterpret_cast<shared::OverlayState*>(m_header + 1);
+
+            m_header->capacity = Capacity;
+            m_header->activeSlots = 0;
+            WriteRelease(reinterpret_cast<volatile LONG*>(&m_header->version), shared::OverlayStateVersion);
+        }
+
+        ~OverlayStateWriter() {
+            UnmapViewOfFile(m_header);
+        }
+
+        void import(uint32_t slot, uint64_t handle, bool isMonitor, const Options& options) {
+            auto& overlay = m_overlays[slot];
+
+            shared::beginWrite(overlay.shellAppSequence);
+            overlay.isMonitor = isMonitor;
+            overlay.opacity = (uint8_t)std::min(options.opacity, 100u);
+            overlay.isInteractable = options.isInteractable;
+            overlay.refreshRate = options.refreshRate;
+            overlay.curvature = options.curvature;
+            overlay.handle = handle;
+            // A new generation lets OVRlay place the overlay in front of the head.
+            overlay.generation++;
+            shared::endWrite(overlay.shellAppSequence);
+
+            WriteRelease64(reinterpret_cast<volatile LONG64*>(&m_header->activeSlots),
+                           m_header->activeSlots | (1ull << slot));
+            WriteRelease(reinterpret_cast<volatile LONG*>(&m_header->changeCount), m_header->changeCount + 1);
+        }
+
+      private:
+        wil::unique_handle m_file;
+        shared::OverlayStateHeader* m_header{nullptr};
+        shared::OverlayState* m_overlays{nullptr};
+    };
+#pragma endregion
+
+    BOOL CALLBACK addMonitor(HMONITOR monitor, HDC, LPRECT, LPARAM data) {
+        reinterpret_cast<std::vector<HMONITOR>*>(data)->push_back(monitor);
+        return true;
+    }
+
+    Options parseOptions(int argc, char** argv) {
+        Options options;
+        for (int i = 1; i < argc; i++) {
+            const std::string arg = argv[i];
+            const auto next = [&]() -> uint32_t {
+                if (i + 1 >= argc) {
+                    throw std::runtime_error("Missing value for " + arg);
+                }
+                return (uint32_t)std::stoul(argv[++i]);
+            };
+            if (arg == "--windows") {
+                options.windowCount = next();
+            } else if (arg == "--monitors") {
+                options.monitorCount = next();
+            } else if (arg == "--width") {
+                options.width = (int)next();
+            } else if (arg == "--height") {
+                options.height = (int)next();
+            } else if (arg == "--opacity") {
+                options.opacity = next();
+            } else if (arg == "--content-rate") {
+                options.contentRate = next();
+            } else if (arg == "--refresh-rate") {
+                options.refreshRate = next();
+            } else if (arg == "--curvature") {
+                options.curvature = next();
+            } else if (arg == "--fps") {
+                options.fps = std::max(next(), 1u);
+            } else if (arg == "--duration") {
+                options.duration = next();
+            } else if (arg == "--interactable") {
+                options.isInteractable = true;
+            } else {
+                throw std::runtime_error("Unknown option " + arg);
+            }
+        }
+        if (options.windowCount + options.monitorCount > OverlayStateWriter::Capacity) {
+            throw std::runtime_error("Too many overlays");
+        }
+        return options;
+    }
+
+    void printStats(const char* name, const shared::TimingStats& stats) {
+        printf("  %-20s min %7.3f ms  avg %7.3f ms  p99 %7.3f ms\n", name, stats.min, stats.avg, stats.p99);
+    }
+
+    int run(const Options& options) {
+        ComPtr<ID3D11Device> device;
+        CHECK_HRCMD(D3D11CreateDevice(nullptr,
+                                      D3D_DRIVER_TYPE_HARDWARE,
+                                      nullptr,
+                                      D3D11_CREATE_DEVICE_BGRA_SUPPORT,
+                                      nullptr,
+                                      0,
+                                      D3D11_SDK_VERSION,
+                                      device.ReleaseAndGetAddressOf(),
+                                      nullptr,
+                                      nullptr));
+
+        OverlayStateWriter stateWriter;
+        TestWindows testWindows(options);
+        std::vector<HMONITOR> monitors;
+        EnumDisplayMonitors(nullptr, nullptr, addMonitor, reinterpret_cast<LPARAM>(&monitors));
+
+        uint32_t slot = 0;
+        for (HWND hwnd : testWindows.getWindows()) {
+            stateWriter.import(slot++, (uint64_t)hwnd, false, options);
+        }
+        for (uint32_t i = 0; i < options.monitorCount && i < monitors.size(); i++) {
+            stateWriter.import(slot++, (uint64_t)monitors[i], true, options);
+        }
+
+        const OVRlay::ovrDispatchTable dispatchTable = mock::GetDispatchTable();
+        const OVRlay::ovrDispatchTable2 dispatchTable2 = mock::GetDispatchTable2();
+        OVRlay::Initialize2(mock::Session, dispatchTable, dispatchTable2, device.Get());
+
+        const wil::unique_handle statsFile(OpenFileMapping(FILE_MAP_READ, false, L"OVRlay.OverlayStats"));
+        const shared::OverlayStats* overlayStats =
+            statsFile ? reinterpret_cast<const shared::OverlayStats*>(
+                            MapViewOfFile(statsFile.get(), FILE_MAP_READ, 0, 0, sizeof(shared::OverlayStats)))
+                      : nullptr;
+
+        printf("%u windows (%dx%d), %u monitors, opacity %u%%, content at %u Hz, %u fps for %u s\n",
+               (uint32_t)testWindows.getWindows().size(),
+               options.width,
+               options.height,
+               (uint32_t)std::min<size_t>(options.monitorCount, monitors.size()),
+               options.opacity,
+               options.contentRate,
+               options.fps,
+               options.duration);
+
+        LARGE_INTEGER frequency;
+        QueryPerformanceFrequency(&frequency);
+        const int64_t frameDuration = frequency.QuadPart / options.fps;
+        const int64_t endTime = getQpcTime() + options.duration * frequency.QuadPart;
+        int64_t nextReportTime = getQpcTime() + frequency.QuadPart;
+        int64_t nextFrameTime = getQpcTime();
+
+        std::vector<const ovrLayerHeader*> layers;
+        layers.reserve(ovrMaxLayerCount);
+        RollingStatistics frameStats;
+        RollingStatistics allocationStats;
+        uint64_t frameCount = 0;
+        uint64_t renderThreadAllocations = 0;
+        const uint64_t initialAllocationCount = g_allocationCount.load();
+        while (getQpcTime() < endTime) {
+            // Pace the frames like a compositor would.
+            while (getQpcTime() < nextFrameTime) {
+                Sleep(0);
+            }
+            nextFrameTime += frameDuration;
+
+            layers.clear();
+            const uint64_t allocationsBefore = t_allocationCount;
+            const int64_t startTime = getQpcTime();
+            OVRlay::GetLayers(mock::ovr_GetTimeInSeconds() + 0.02, layers);
+            const int64_t stopTime = getQpcTime();
+            const uint64_t allocations = t_allocationCount - allocationsBefore;
+            renderThreadAllocations += allocations;
+            frameStats.addSample((float)((stopTime - startTime) * 1000.0 / frequency.QuadPart));
+            allocationStats.addSample((float)allocations);
+            frameCount++;
+
+            if (stopTime >= nextReportTime) {
+                nextReportTime += frequency.QuadPart;
+
+                printf("Frame %llu: %u layers, %u swapchains, %llu commits\n",
+                       frameCount,
+                       (uint32_t)layers.size(),
+                       mock::g_swapchainCount.load(),
+                       mock::g_commitCount.load());
+                printStats("GetLayers (CPU)", frameStats.compute());
+                // Skip the report while OVRlay is publishing the statistics.
+                shared::OverlayStats stats;
+                if (overlayStats && shared::tryRead(*overlayStats, overlayStats->sequence, stats)) {
+                    printStats("SortWindows", stats.sortWindows);
+                    printStats("HandleInteractions", stats.handleInteractions);
+                    printStats("UpdateWindows", stats.updateWindows);
+                    // The min and p99 of the overlays cannot be added up, only the averages.
+                    float gpuTime = 0;
+                    for (uint32_t i = 0; i < std::min(stats.overlayCount, shared::MaxOverlayCount); i++) {
+                        char name[32];
+                        sprintf_s(name, "GPU (overlay %u)", i);
+                        printStats(name, stats.gpuTime[i]);
+                        gpuTime += stats.gpuTime[i].avg;
+                    }
+                    printf("  %-20s avg %7.3f ms\n", "GPU (all overlays)", gpuTime);
+                }
+                const shared::TimingStats allocations = allocationStats.compute();
+                printf("  %-20s avg %7.1f  p99 %7.1f  per frame\n", "Allocations", allocations.avg, allocations.p99);
+            }
+        }
+
+        printf("Done: %llu frames, %llu allocations on the render thread (%.2f per frame), %llu in total\n",
+               frameCount,
+               renderThreadAllocations,
+               frameCount ? (double)renderThreadAllocations / frameCount : 0.0,
+               g_allocationCount.load() - initialAllocationCount);
+
+        if (overlayStats) {
+            UnmapViewOfFile(overlayStats);
+        }
+        return 0;
+    }
+
+} // namespace
+
+int main(int argc, char** argv) {
+    try {
+        winrt::init_apartment(winrt::apartment_type::multi_threaded);
+        return run(parseOptions(argc, argv));
+    } catch (std::exception& exc) {
+        fprintf(stderr, "Error: %s\n", exc.what());
+    } catch (winrt::hresult_error& exc) {
+        fprintf(stderr, "Error: %X\n", (uint32_t)exc.code().value);
+    }
+    return 1;
+}
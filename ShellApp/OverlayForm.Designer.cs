@@ -41,6 +41,16 @@ namespace WindowsFormsApp
             this.placement = new System.Windows.Forms.ComboBox();
             this.freeze = new System.Windows.Forms.CheckBox();
             this.allowInteractions = new System.Windows.Forms.CheckBox();
+            this.colorKey = new System.Windows.Forms.CheckBox();
+            this.colorKeyColor = new System.Windows.Forms.Button();
+            this.colorKeyToleranceLabel = new System.Windows.Forms.Label();
+            this.colorKeyTolerance = new System.Windows.Forms.NumericUpDown();
+            this.refreshRateLabel = new System.Windows.Forms.Label();
+            this.refreshRate = new System.Windows.Forms.ComboBox();
+            this.curvatureLabel = new System.Windows.Forms.Label();
+            this.curvature = new System.Windows.Forms.ComboBox();
+            this.snapshot = new System.Windows.Forms.CheckBox();
+            this.takeSnapshot = new System.Windows.Forms.Button();
             this.availableWindows = new System.Windows.Forms.ListBox();
             this.importedWindows = new System.Windows.Forms.ListBox();
             this.refresh = new System.Windows.Forms.Timer(this.components);
@@ -48,6 +58,7 @@ namespace WindowsFormsApp
             this.tableLayoutPanel2.SuspendLayout();
             this.flowLayoutPanel1.SuspendLayout();
             ((System.ComponentModel.ISupportInitialize)(this.opacity)).BeginInit();
+            ((System.ComponentModel.ISupportInitialize)(this.colorKeyTolerance)).BeginInit();
             this.SuspendLayout();
             // 
             // tableLayoutPanel1
@@ -65,8 +76,8 @@ namespace WindowsFormsApp
             this.tableLayoutPanel1.RowStyles.Add(new System.Windows.Forms.RowStyle(System.Windows.Forms.SizeType.Percent, 70F));
             this.tableLayoutPanel1.RowStyles.Add(new System.Windows.Forms.RowStyle(System.Windows.Forms.SizeType.Absolute, 54F));
             this.tableLayoutPanel1.RowStyles.Add(new System.Windows.Forms.RowStyle(System.Windows.Forms.SizeType.Percent, 30F));
-            this.tableLayoutPanel1.RowStyles.Add(new System.Windows.Forms.RowStyle(System.Windows.Forms.SizeType.Absolute, 110F));
-            this.tableLayoutPanel1.Size = new System.Drawing.Size(365, 402);
+            this.tableLayoutPanel1.RowStyles.Add(new System.Windows.Forms.RowStyle(System.Windows.Forms.SizeType.Absolute, 193F));
+            this.tableLayoutPanel1.Size = new System.Drawing.Size(365, 485);
             this.tableLayoutPanel1.TabIndex = 0;
             // 
             // tableLayoutPanel2
@@ -114,10 +125,20 @@ namespace WindowsFormsApp
             this.flowLayoutPanel1.Controls.Add(this.placement);
             this.flowLayoutPanel1.Controls.Add(this.freeze);
             this.flowLayoutPanel1.Controls.Add(this.allowInteractions);
+            this.flowLayoutPanel1.Controls.Add(this.colorKey);
+            this.flowLayoutPanel1.Controls.Add(this.colorKeyColor);
+            this.flowLayoutPanel1.Controls.Add(this.colorKeyToleranceLabel);
+            this.flowLayoutPanel1.Controls.Add(this.colorKeyTolerance);
+            this.flowLayoutPanel1.Controls.Add(this.refreshRateLabel);
+            this.flowLayoutPanel1.Controls.Add(this.refreshRate);
+            this.flowLayoutPanel1.Controls.Add(this.curvatureLabel);
+            this.flowLayoutPanel1.Controls.Add(this.curvature);
+            this.flowLayoutPanel1.Controls.Add(this.snapshot);
+            this.flowLayoutPanel1.Controls.Add(this.takeSnapshot);
             this.flowLayoutPanel1.Dock = System.Windows.Forms.DockStyle.Fill;
             this.flowLayoutPanel1.Location = new System.Drawing.Point(3, 294);
             this.flowLayoutPanel1.Name = "flowLayoutPanel1";
-            this.flowLayoutPanel1.Size = new System.Drawing.Size(359, 105);
+            this.flowLayoutPanel1.Size = new System.Drawing.Size(359, 188);
             this.flowLayoutPanel1.TabIndex = 1;
             // 
             // opacityLabel
@@ -188,6 +209,7 @@ namespace WindowsFormsApp
             // allowInteractions
             // 
             this.allowInteractions.AutoSize = true;
+            this.flowLayoutPanel1.SetFlowBreak(this.allowInteractions, true);
             this.allowInteractions.Location = new System.Drawing.Point(142, 75);
             this.allowInteractions.Name = "allowInteractions";
             this.allowInteractions.Padding = new System.Windows.Forms.Padding(0, 3, 0, 0);
@@ -197,6 +219,128 @@ namespace WindowsFormsApp
             this.allowInteractions.UseVisualStyleBackColor = true;
             this.allowInteractions.CheckedChanged += new System.EventHandler(this.allowInteractions_CheckedChanged);
             // 
+            // colorKey
+            // 
+            this.colorKey.AutoSize = true;
+            this.colorKey.Location = new System.Drawing.Point(3, 101);
+            this.colorKey.Name = "colorKey";
+            this.colorKey.Padding = new System.Windows.Forms.Padding(0, 3, 0, 0);
+            this.colorKey.Size = new System.Drawing.Size(70, 20);
+            this.colorKey.TabIndex = 7;
+            this.colorKey.Text = "Color key";
+            this.colorKey.UseVisualStyleBackColor = true;
+            this.colorKey.CheckedChanged += new System.EventHandler(this.colorKey_CheckedChanged);
+            // 
+            // colorKeyColor
+            // 
+            this.colorKeyColor.BackColor = System.Drawing.Color.Black;
+            this.colorKeyColor.Location = new System.Drawing.Point(79, 101);
+            this.colorKeyColor.Name = "colorKeyColor";
+            this.colorKeyColor.Size = new System.Drawing.Size(40, 23);
+            this.colorKeyColor.TabIndex = 8;
+            this.colorKeyColor.UseVisualStyleBackColor = false;
+            this.colorKeyColor.Click += new System.EventHandler(this.colorKeyColor_Click);
+            // 
+            // colorKeyToleranceLabel
+            // 
+            this.colorKeyToleranceLabel.AutoSize = true;
+            this.colorKeyToleranceLabel.Location = new System.Drawing.Point(125, 98);
+            this.colorKeyToleranceLabel.Name = "colorKeyToleranceLabel";
+            this.colorKeyToleranceLabel.Padding = new System.Windows.Forms.Padding(0, 6, 0, 0);
+            this.colorKeyToleranceLabel.Size = new System.Drawing.Size(58, 19);
+            this.colorKeyToleranceLabel.TabIndex = 9;
+            this.colorKeyToleranceLabel.Text = "Tolerance:";
+            // 
+            // colorKeyTolerance
+            // 
+            this.flowLayoutPanel1.SetFlowBreak(this.colorKeyTolerance, true);
+            this.colorKeyTolerance.Location = new System.Drawing.Point(189, 101);
+            this.colorKeyTolerance.Maximum = new decimal(new int[] {
+            255,
+            0,
+            0,
+            0});
+            this.colorKeyTolerance.Name = "colorKeyTolerance";
+            this.colorKeyTolerance.Size = new System.Drawing.Size(50, 20);
+            this.colorKeyTolerance.TabIndex = 10;
+            this.colorKeyTolerance.ValueChanged += new System.EventHandler(this.colorKeyTolerance_ValueChanged);
+            // 
+            // refreshRateLabel
+            // 
+            this.refreshRateLabel.AutoSize = true;
+            this.refreshRateLabel.Location = new System.Drawing.Point(3, 127);
+            this.refreshRateLabel.Name = "refreshRateLabel";
+            this.refreshRateLabel.Padding = new System.Windows.Forms.Padding(0, 3, 0, 0);
+            this.refreshRateLabel.Size = new System.Drawing.Size(70, 16);
+            this.refreshRateLabel.TabIndex = 11;
+            this.refreshRateLabel.Text = "Refresh rate:";
+            // 
+            // refreshRate
+            // 
+            this.refreshRate.DropDownStyle = System.Windows.Forms.ComboBoxStyle.DropDownList;
+            this.refreshRate.FormattingEnabled = true;
+            this.refreshRate.Items.AddRange(new object[] {
+            "Native",
+            "60 Hz",
+            "30 Hz",
+            "10 Hz"});
+            this.refreshRate.Location = new System.Drawing.Point(79, 127);
+            this.refreshRate.Margin = new System.Windows.Forms.Padding(3, 0, 3, 3);
+            this.refreshRate.Name = "refreshRate";
+            this.refreshRate.Size = new System.Drawing.Size(80, 21);
+            this.refreshRate.TabIndex = 12;
+            this.refreshRate.SelectedIndexChanged += new System.EventHandler(this.refreshRate_SelectedIndexChanged);
+            // 
+            // curvatureLabel
+            // 
+            this.curvatureLabel.AutoSize = true;
+            this.curvatureLabel.Location = new System.Drawing.Point(165, 127);
+            this.curvatureLabel.Name = "curvatureLabel";
+            this.curvatureLabel.Padding = new System.Windows.Forms.Padding(0, 3, 0, 0);
+            this.curvatureLabel.Size = new System.Drawing.Size(56, 16);
+            this.curvatureLabel.TabIndex = 13;
+            this.curvatureLabel.Text = "Curvature:";
+            // 
+            // curvature
+            // 
+            this.curvature.DropDownStyle = System.Windows.Forms.ComboBoxStyle.DropDownList;
+            this.flowLayoutPanel1.SetFlowBreak(this.curvature, true);
+            this.curvature.FormattingEnabled = true;
+            this.curvature.Items.AddRange(new object[] {
+            "Flat",
+            "60°",
+            "90°",
+            "120°"});
+            this.curvature.Location = new System.Drawing.Point(227, 127);
+            this.curvature.Margin = new System.Windows.Forms.Padding(3, 0, 3, 3);
+            this.curvature.Name = "curvature";
+            this.curvature.Size = new System.Drawing.Size(80, 21);
+            this.curvature.TabIndex = 14;
+            this.curvature.SelectedIndexChanged += new System.EventHandler(this.curvature_SelectedIndexChanged);
+            // 
+            // snapshot
+            // 
+            this.snapshot.AutoSize = true;
+            this.snapshot.Location = new System.Drawing.Point(3, 154);
+            this.snapshot.Name = "snapshot";
+            this.snapshot.Padding = new System.Windows.Forms.Padding(0, 3, 0, 0);
+            this.snapshot.Size = new System.Drawing.Size(70, 20);
+            this.snapshot.TabIndex = 15;
+            this.snapshot.Text = "Snapshot";
+            this.snapshot.UseVisualStyleBackColor = true;
+            this.snapshot.CheckedChanged += new System.EventHandler(this.snapshot_CheckedChanged);
+            // 
+            // takeSnapshot
+            // 
+            this.takeSnapshot.Enabled = false;
+            this.takeSnapshot.Location = new System.Drawing.Point(79, 154);
+            this.takeSnapshot.Name = "takeSnapshot";
+            this.takeSnapshot.Size = new System.Drawing.Size(90, 23);
+            this.takeSnapshot.TabIndex = 16;
+            this.takeSnapshot.Text = "Take snapshot";
+            this.takeSnapshot.UseVisualStyleBackColor = true;
+            this.takeSnapshot.Click += new System.EventHandler(this.takeSnapshot_Click);
+            // 
             // availableWindows
             // 
             this.availableWindows.Dock = System.Windows.Forms.DockStyle.Fill;
@@ -227,7 +371,7 @@ namespace WindowsFormsApp
             // 
             this.AutoScaleDimensions = new System.Drawing.SizeF(6F, 13F);
             this.AutoScaleMode = System.Windows.Forms.AutoScaleMode.Font;
-            this.ClientSize = new System.Drawing.Size(365, 402);
+            this.ClientSize = new System.Drawing.Size(365, 485);
             this.Controls.Add(this.tableLayoutPanel1);
             this.FormBorderStyle = System.Windows.Forms.FormBorderStyle.FixedSingle;
             this.Margin = new System.Windows.Forms.Padding(2);
@@ -239,6 +383,7 @@ namespace WindowsFormsApp
             this.flowLayoutPanel1.ResumeLayout(false);
             this.flowLayoutPanel1.PerformLayout();
             ((System.ComponentModel.ISupportInitialize)(this.opacity)).EndInit();
+            ((System.ComponentModel.ISupportInitialize)(this.colorKeyTolerance)).EndInit();
             this.ResumeLayout(false);
 
         }
@@ -256,6 +401,16 @@ namespace WindowsFormsApp
         private System.Windows.Forms.ComboBox placement;
         private System.Windows.Forms.CheckBox freeze;
         private System.Windows.Forms.CheckBox allowInteractions;
+        private System.Windows.Forms.CheckBox colorKey;
+        private System.Windows.Forms.Button colorKeyColor;
+        private System.Windows.Forms.Label colorKeyToleranceLabel;
+        private System.Windows.Forms.NumericUpDown colorKeyTolerance;
+        private System.Windows.Forms.Label refreshRateLabel;
+        private System.Windows.Forms.ComboBox refreshRate;
+        private System.Windows.Forms.Label curvatureLabel;
+        private System.Windows.Forms.ComboBox curvature;
+        private System.Windows.Forms.CheckBox snapshot;
+        private System.Windows.Forms.Button takeSnapshot;
         private System.Windows.Forms.ListBox availableWindows;
         private System.Windows.Forms.ListBox importedWindows;
         private System.Windows.Forms.Timer refresh;
@@ -19,6 +19,16 @@ namespace WindowsFormsApp
     {
         private const string OverlaysMapName = "OVRlay.OverlayState";
 
+        // Must match the definitions in OVRlay.cpp.
+        private const uint OverlayStateVersion = 8;
+        private const int OverlayCapacity = 16;
+
+        // The choices in the refresh rate drop-down, in Hz (0 for every frame).
+        private static readonly uint[] RefreshRates = { 0, 60, 30, 10 };
+
+        // The choices in the curvature drop-down, as the angle covered by the overlay in degrees (0 for flat).
+        private static readonly uint[] Curvatures = { 0, 60, 90, 120 };
+
         [StructLayout(LayoutKind.Sequential)]
         private struct Vector3
         {
@@ -66,17 +76,32 @@ namespace WindowsFormsApp
             public bool isFrozen;
             [MarshalAs(UnmanagedType.I1)]
             public bool isMinimized;
+            [MarshalAs(UnmanagedType.I1)]
+            public bool isColorKeyed;
+            public byte colorKeyTolerance;
+            public uint colorKey;
+            public uint generation;
+            public uint shellAppSequence;
+            public uint ovrlaySequence;
+            public uint poseGeneration;
+            public uint refreshRate;
+            public uint curvature;
+            public uint snapshotRequest;
+            [MarshalAs(UnmanagedType.I1)]
+            public bool isSnapshot;
             #endregion
         };
 
+        // Followed by capacity OverlayState.
         [StructLayout(LayoutKind.Sequential)]
-        private struct Overlays
+        private struct OverlayStateHeader
         {
             #region Fields
-            public OverlayState window0;
-            public OverlayState window1;
-            public OverlayState window2;
-            public OverlayState window3;
+            public uint version;
+            public uint capacity;
+            public ulong activeSlots;
+            public uint changeCount;
+            public uint reserved;
             #endregion
         };
 
@@ -84,6 +109,7 @@ namespace WindowsFormsApp
         {
             Import,
             Update,
+            Snapshot,
             Remove
         }
 
@@ -93,11 +119,18 @@ namespace WindowsFormsApp
             public int placement;
             public bool isFrozen;
             public bool isInteractable;
+            public bool isColorKeyed;
+            public Color colorKey;
+            public int colorKeyTolerance;
+            public int refreshRate;
+            public int curvature;
+            public bool isSnapshot;
         }
 
         private MemoryMappedFile mappedFile;
         private MemoryMappedViewAccessor mappedView;
-        private Overlays* overlays;
+        private OverlayStateHeader* header;
+        private OverlayState* overlays;
         private Dictionary<IntPtr, WindowState> windowState = new Dictionary<IntPtr, WindowState>();
 
         public OverlayForm()
@@ -108,25 +141,33 @@ namespace WindowsFormsApp
 
             refresh_Tick(null, null);
 
-            var size = Marshal.SizeOf<Overlays>();
+            var size = Marshal.SizeOf<OverlayStateHeader>() + OverlayCapacity * Marshal.SizeOf<OverlayState>();
             try
             {
-#if !DEBUG
-                mappedFile = MemoryMappedFile.OpenExisting(OverlaysMapName, MemoryMappedFileRights.ReadWrite);
-#else
                 mappedFile = MemoryMappedFile.CreateOrOpen(OverlaysMapName, size, MemoryMappedFileAccess.ReadWrite);
-#endif
                 mappedView = mappedFile.CreateViewAccessor(0, size);
 
                 byte* ptr = null;
                 mappedView.SafeMemoryMappedViewHandle.AcquirePointer(ref ptr);
-                overlays = (Overlays*)ptr;
+                header = (OverlayStateHeader*)ptr;
+                overlays = (OverlayState*)(header + 1);
+
+                if (header->version == 0)
+                {
+                    header->capacity = OverlayCapacity;
+                    header->activeSlots = 0;
+                    Volatile.Write(ref header->version, OverlayStateVersion);
+                }
+                else if (header->version != OverlayStateVersion || header->capacity != OverlayCapacity)
+                {
+                    throw new InvalidDataException();
+                }
 
                 // TODO: Read state from previous instance.
             }
             catch
             {
-                MessageBox.Show(this, "Failed to open MemoryMappedFile. Make sure the Virtual Desktop Streamer (v1.30 or later) is running.", "Error", MessageBoxButtons.OK, MessageBoxIcon.Error);
+                MessageBox.Show(this, "Failed to open MemoryMappedFile. Make sure no other version of the application is running.", "Error", MessageBoxButtons.OK, MessageBoxIcon.Error);
             }
         }
 
@@ -138,6 +179,12 @@ namespace WindowsFormsApp
             state.placement = placement.SelectedIndex;
             state.isFrozen = freeze.Checked;
             state.isInteractable = allowInteractions.Checked;
+            state.isColorKeyed = colorKey.Checked;
+            state.colorKey = colorKeyColor.BackColor;
+            state.colorKeyTolerance = (int)colorKeyTolerance.Value;
+            state.refreshRate = refreshRate.SelectedIndex;
+            state.curvature = curvature.SelectedIndex;
+            state.isSnapshot = snapshot.Checked;
             windowState[hwnd] = state;
             bool isMonitor = false;
             for (int i = 0; i < numMonitors; i++)
@@ -149,28 +196,24 @@ namespace WindowsFormsApp
                 }
             }
 
-            switch (importedWindows.SelectedIndex)
-            {
-                case 0:
-                    syncState(ref overlays->window0, hwnd, state, op, isMonitor);
-                    break;
-                case 1:
-                    syncState(ref overlays->window1, hwnd, state, op, isMonitor);
-                    break;
-                case 2:
-                    syncState(ref overlays->window2, hwnd, state, op, isMonitor);
-                    break;
-                case 3:
-                    syncState(ref overlays->window3, hwnd, state, op, isMonitor);
-                    break;
-            }
+            syncState(slotForImportedWindow[importedWindows.SelectedIndex], hwnd, state, op, isMonitor);
         }
 
-        private void syncState(ref OverlayState overlay, IntPtr handle, WindowState state, Operation op, bool isMonitor = false)
+        private void syncState(int slot, IntPtr handle, WindowState state, Operation op, bool isMonitor = false)
         {
+            ref OverlayState overlay = ref overlays[slot];
+
+            // The render thread never waits for us: it skips the slot while the sequence is odd or changed under it.
+            overlay.shellAppSequence++;
+            Thread.MemoryBarrier();
             if (op == Operation.Remove)
             {
                 overlay.handle = 0;
+                overlay.generation++;
+                Volatile.Write(ref overlay.shellAppSequence, overlay.shellAppSequence + 1);
+
+                // Do this last to avoid tearing.
+                Volatile.Write(ref header->activeSlots, header->activeSlots & ~(1UL << slot));
             }
             else
             {
@@ -178,25 +221,41 @@ namespace WindowsFormsApp
                 overlay.placement = (byte)state.placement;
                 overlay.isFrozen = state.isFrozen;
                 overlay.isInteractable = state.isInteractable;
+                overlay.colorKey = (uint)(state.colorKey.ToArgb() & 0xffffff);
+                overlay.colorKeyTolerance = (byte)state.colorKeyTolerance;
+                overlay.isColorKeyed = state.isColorKeyed;
+                overlay.refreshRate = RefreshRates[Math.Max(state.refreshRate, 0)];
+                overlay.curvature = Curvatures[Math.Max(state.curvature, 0)];
+                overlay.isSnapshot = state.isSnapshot;
+                if (op == Operation.Snapshot)
+                {
+                    overlay.snapshotRequest++;
+                }
 
                 if (op == Operation.Import)
                 {
-                    overlay.pose.position.x = overlay.pose.position.y = overlay.pose.position.z = float.NaN;
-                    overlay.pose.orientation.x = overlay.pose.orientation.y = overlay.pose.orientation.z = overlay.pose.orientation.w = float.NaN;
-                    overlay.scale = 1.0f;
-                    overlay.isMinimized = false;
-
+                    // The new generation tells OVRlay to place the window again (it owns the pose, scale and isMinimized).
                     overlay.isMonitor = isMonitor;
+                    overlay.handle = (ulong)handle;
+                    overlay.generation++;
+                }
+                Volatile.Write(ref overlay.shellAppSequence, overlay.shellAppSequence + 1);
 
+                if (op == Operation.Import)
+                {
                     // Do this last to avoid tearing.
-                    overlay.handle = (ulong)handle;
+                    Volatile.Write(ref header->activeSlots, header->activeSlots | (1UL << slot));
                 }
             }
+
+            // Tell the render thread to look at the slots again.
+            Volatile.Write(ref header->changeCount, header->changeCount + 1);
         }
 
         int numMonitors = 0;
         List<IntPtr> hwndForAvailableWindow = new List<IntPtr>();
         List<IntPtr> hwndForImportedWindow = new List<IntPtr>();
+        List<int> slotForImportedWindow = new List<int>();
         private void refresh_Tick(object sender, EventArgs e)
         {
             availableWindows.BeginUpdate();
@@ -257,7 +316,7 @@ namespace WindowsFormsApp
 
         private void availableWindows_SelectedIndexChanged(object sender, EventArgs e)
         {
-            import.Enabled = importedWindows.Items.Count < 4 && availableWindows.SelectedItem != null && availableWindows.SelectedIndex != numMonitors;
+            import.Enabled = importedWindows.Items.Count < OverlayCapacity && availableWindows.SelectedItem != null && availableWindows.SelectedIndex != numMonitors;
         }
 
         private void import_Click(object sender, EventArgs e)
@@ -265,6 +324,12 @@ namespace WindowsFormsApp
             var hwnd = hwndForAvailableWindow[availableWindows.SelectedIndex];
             importedWindows.Items.Add(availableWindows.SelectedItem);
             hwndForImportedWindow.Add(hwnd);
+            int slot = 0;
+            while (slotForImportedWindow.Contains(slot))
+            {
+                slot++;
+            }
+            slotForImportedWindow.Add(slot);
             importedWindows.SelectedIndex = importedWindows.Items.Count - 1;
 
             // Set defaults.
@@ -272,6 +337,12 @@ namespace WindowsFormsApp
             placement.SelectedIndex = 0;
             freeze.Checked = false;
             allowInteractions.Checked = true;
+            colorKey.Checked = false;
+            colorKeyColor.BackColor = Color.Black;
+            colorKeyTolerance.Value = 0;
+            refreshRate.SelectedIndex = 0;
+            curvature.SelectedIndex = 0;
+            snapshot.Checked = false;
             refresh_Tick(null, null);
 
             pushUpdate(Operation.Import);
@@ -281,25 +352,13 @@ namespace WindowsFormsApp
         {
             var index = importedWindows.SelectedIndex;
             var hwnd = hwndForImportedWindow[index];
+            var slot = slotForImportedWindow[index];
             hwndForImportedWindow.RemoveAt(index);
+            slotForImportedWindow.RemoveAt(index);
             importedWindows.Items.RemoveAt(index);
             refresh_Tick(null, null);
 
-            switch (index)
-            {
-                case 0:
-                    overlays->window0.handle = 0;
-                    break;
-                case 1:
-                    overlays->window1.handle = 0;
-                    break;
-                case 2:
-                    overlays->window2.handle = 0;
-                    break;
-                case 3:
-                    overlays->window3.handle = 0;
-                    break;
-            }
+            syncState(slot, hwnd, new WindowState(), Operation.Remove);
 
             availableWindows_SelectedIndexChanged(null, null);
         }
@@ -307,7 +366,9 @@ namespace WindowsFormsApp
         private void importedWindows_SelectedIndexChanged(object sender, EventArgs e)
         {
             opacityLabel.Enabled = opacity.Enabled = placementLabel.Enabled = placement.Enabled =
-                freeze.Enabled = allowInteractions.Enabled = remove.Enabled = importedWindows.SelectedItem != null;
+                freeze.Enabled = allowInteractions.Enabled = colorKey.Enabled = colorKeyColor.Enabled =
+                colorKeyToleranceLabel.Enabled = colorKeyTolerance.Enabled = refreshRateLabel.Enabled = refreshRate.Enabled =
+                curvatureLabel.Enabled = curvature.Enabled = snapshot.Enabled = remove.Enabled = importedWindows.SelectedItem != null;
             if (importedWindows.SelectedItem != null)
             {
                 var hwnd = hwndForImportedWindow[importedWindows.SelectedIndex];
@@ -319,8 +380,15 @@ namespace WindowsFormsApp
                     placement.SelectedIndex = state.placement;
                     freeze.Checked = state.isFrozen;
                     allowInteractions.Checked = state.isInteractable;
+                    colorKey.Checked = state.isColorKeyed;
+                    colorKeyColor.BackColor = state.colorKey;
+                    colorKeyTolerance.Value = state.colorKeyTolerance;
+                    refreshRate.SelectedIndex = state.refreshRate;
+                    curvature.SelectedIndex = state.curvature;
+                    snapshot.Checked = state.isSnapshot;
                 }
             }
+            takeSnapshot.Enabled = snapshot.Enabled && snapshot.Checked;
         }
 
         private void opacity_Scroll(object sender, EventArgs e)
@@ -343,6 +411,50 @@ namespace WindowsFormsApp
             pushUpdate(Operation.Update);
         }
 
+        private void colorKey_CheckedChanged(object sender, EventArgs e)
+        {
+            pushUpdate(Operation.Update);
+        }
+
+        private void colorKeyColor_Click(object sender, EventArgs e)
+        {
+            using (var dialog = new ColorDialog())
+            {
+                dialog.Color = colorKeyColor.BackColor;
+                if (dialog.ShowDialog(this) == DialogResult.OK)
+                {
+                    colorKeyColor.BackColor = dialog.Color;
+                    pushUpdate(Operation.Update);
+                }
+            }
+        }
+
+        private void colorKeyTolerance_ValueChanged(object sender, EventArgs e)
+        {
+            pushUpdate(Operation.Update);
+        }
+
+        private void refreshRate_SelectedIndexChanged(object sender, EventArgs e)
+        {
+            pushUpdate(Operation.Update);
+        }
+
+        private void curvature_SelectedIndexChanged(object sender, EventArgs e)
+        {
+            pushUpdate(Operation.Update);
+        }
+
+        private void snapshot_CheckedChanged(object sender, EventArgs e)
+        {
+            takeSnapshot.Enabled = snapshot.Enabled && snapshot.Checked;
+            pushUpdate(Operation.Update);
+        }
+
+        private void takeSnapshot_Click(object sender, EventArgs e)
+        {
+            pushUpdate(Operation.Snapshot);
+        }
+
         private class User32
         {
             [DllImport("user32.dll")]